@@ -0,0 +1,120 @@
+// Throughput of Utils::extract_text_from_html against the std::regex chain it replaced
+// Usage: html_extract_bench [Posts.xml] [max_bodies]
+// Without a file, bodies shaped like Stack Exchange posts (paragraphs, code, links, entities) are generated
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "utils.hpp"
+#include "xml_row_reader.hpp"
+
+// The cleaning code before the single-pass extractor, one regex_replace per step
+static std::string regex_extract(const std::string& html) {
+    if (html.empty()) {
+        return "";
+    }
+
+    std::string result = html;
+    result = std::regex_replace(result, std::regex("<[^>]*>"), "");
+    result = std::regex_replace(result, std::regex("&amp;"), "&");
+    result = std::regex_replace(result, std::regex("&lt;"), "<");
+    result = std::regex_replace(result, std::regex("&gt;"), ">");
+    result = std::regex_replace(result, std::regex("&nbsp;"), " ");
+    result = std::regex_replace(result, std::regex("\\s+"), " ");
+    result = std::regex_replace(result, std::regex("^ | $"), "");
+    return result;
+}
+
+static std::vector<std::string> generate_bodies(size_t count) {
+    static const char* words[] = {"ubuntu", "install", "package", "the", "kernel", "boot", "grub", "sudo",
+                                  "apt-get", "update", "network", "driver", "error", "file", "system", "a"};
+    std::mt19937_64 rng(42);
+    std::vector<std::string> bodies(count);
+    for (auto& body : bodies) {
+        size_t paragraphs = 1 + rng() % 5;
+        for (size_t p = 0; p < paragraphs; p++) {
+            if (rng() % 4 == 0) {
+                body += "<pre><code>sudo apt-get install foo &amp;&amp; echo &quot;done&quot; &gt; /tmp/log\n</code></pre>\n\n";
+            }
+            body += "<p>";
+            size_t length = 20 + rng() % 60;
+            for (size_t w = 0; w < length; w++) {
+                body += words[rng() % 16];
+                if (rng() % 20 == 0) body += " <a href=\"https://askubuntu.com/q/1\" rel=\"nofollow\">link</a>";
+                if (rng() % 30 == 0) body += " &nbsp;&mdash;&#160;";
+                body += ' ';
+            }
+            body += "</p>\n\n";
+        }
+    }
+    return bodies;
+}
+
+static std::vector<std::string> load_bodies(const std::string& path, size_t limit) {
+    std::vector<std::string> bodies;
+    XmlRowReader reader;
+    if (!reader.open(path)) {
+        std::cerr << "Could not open " << path << "\n";
+        return bodies;
+    }
+    while (bodies.size() < limit) {
+        auto row = reader.next();
+        if (!row.has_value()) break;
+        if (auto body = row->attribute("Body")) bodies.emplace_back(body.as_string());
+    }
+    return bodies;
+}
+
+// Runs clean over all bodies and returns MB/s of input, checksum keeps the optimizer honest
+template <typename Clean>
+static double run(const std::vector<std::string>& bodies, size_t bytes, Clean clean, size_t& checksum) {
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& body : bodies) checksum += clean(body);
+    auto end = std::chrono::steady_clock::now();
+    return bytes / 1e6 / std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char** argv) {
+    std::string path = argc > 1 ? argv[1] : "";
+    size_t max_bodies = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 20000;
+
+    auto bodies = path.empty() ? generate_bodies(max_bodies) : load_bodies(path, max_bodies);
+    size_t bytes = 0;
+    for (const auto& body : bodies) bytes += body.size();
+    std::cout << "bodies: " << bodies.size() << ", " << bytes / 1e6 << " MB\n";
+
+    // Outputs only differ where the regex chain left entities undecoded or decoded one twice
+    size_t differing = 0;
+    for (const auto& body : bodies) {
+        if (regex_extract(body) != Utils::extract_text_from_html(body)) differing++;
+    }
+    std::cout << "bodies with different text: " << differing << "\n\n";
+
+    size_t checksum = 0;
+    std::string scratch;
+    double regex_mbs = run(bodies, bytes, [](const std::string& b) { return regex_extract(b).size(); }, checksum);
+    double copy_mbs = run(bodies, bytes, [](const std::string& b) { return Utils::extract_text_from_html(b).size(); },
+                          checksum);
+    double reuse_mbs = run(bodies, bytes, [&scratch](const std::string& b) {
+        Utils::extract_text_from_html(b, scratch);
+        return scratch.size();
+    }, checksum);
+
+    auto report = [regex_mbs](const char* name, double mbs) {
+        std::cout << "  " << std::left << std::setw(22) << name
+                  << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(10) << mbs << " MB/s"
+                  << std::setw(8) << std::setprecision(1) << mbs / regex_mbs << "x\n";
+    };
+    report("regex chain", regex_mbs);
+    report("single pass", copy_mbs);
+    report("single pass, reused", reuse_mbs);
+    std::cout << "  (checksum " << checksum % 1000 << ")\n";
+
+    return 0;
+}
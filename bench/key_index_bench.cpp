@@ -0,0 +1,86 @@
+// Point lookup latency of the KeyIndex layouts
+// Usage: key_index_bench [num_keys] [num_lookups]
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "compound_key.hpp"
+#include "key_index.hpp"
+
+static const char* layout_name(KeyIndex::Layout layout) {
+    switch (layout) {
+        case KeyIndex::Layout::BINARY:        return "binary";
+        case KeyIndex::Layout::EYTZINGER:     return "eytzinger";
+        case KeyIndex::Layout::INTERPOLATION: return "interpolation";
+    }
+    return "?";
+}
+
+// Runs the lookups and returns nanoseconds per lookup, found keeps the optimizer honest
+static double run(const KeyIndex& index, const std::vector<uint64_t>& probes, uint64_t& found) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t key : probes) {
+        auto offset = index.find(key);
+        if (offset.has_value()) found += *offset;
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / probes.size();
+}
+
+int main(int argc, char** argv) {
+    size_t num_keys = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+    size_t num_lookups = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2000000;
+
+    std::mt19937_64 rng(42);
+
+    // Two key spaces: post ids of one site with gaps (like the data index) and dense word ids (like barrels)
+    std::vector<std::pair<const char*, std::vector<std::pair<uint64_t, uint64_t> > > > datasets(2);
+    datasets[0].first = "POST_BY_ID keys, sparse ids";
+    datasets[1].first = "dense word ids";
+
+    uint32_t post_id = 0;
+    for (size_t i = 0; i < num_keys; i++) {
+        post_id += 1 + rng() % 8;
+        CompoundKey k(static_cast<uint8_t>(KeyType::POST_BY_ID), static_cast<uint16_t>(SiteID::ASK_UBUNTU), post_id, 0);
+        datasets[0].second.emplace_back(k.pack(), i * 64);
+        datasets[1].second.emplace_back(i + 1, i * 64);
+    }
+
+    std::cout << "keys: " << num_keys << ", lookups: " << num_lookups << "\n";
+    for (auto& [name, entries] : datasets) {
+        // Half of the probes hit, half are misses in between existing keys
+        std::vector<uint64_t> probes(num_lookups);
+        for (auto& probe : probes) {
+            const auto& entry = entries[rng() % entries.size()];
+            probe = entry.first + (rng() % 2 == 0 ? 0 : 1);
+        }
+
+        std::cout << "\n" << name << "\n";
+        double baseline = 0;
+        for (auto layout : {KeyIndex::Layout::BINARY, KeyIndex::Layout::EYTZINGER, KeyIndex::Layout::INTERPOLATION}) {
+            KeyIndex index(layout);
+
+            auto build_start = std::chrono::steady_clock::now();
+            index.assign(entries);
+            auto build_end = std::chrono::steady_clock::now();
+
+            uint64_t found = 0;
+            run(index, probes, found); // Warm up
+            double ns = run(index, probes, found);
+            if (layout == KeyIndex::Layout::BINARY) baseline = ns;
+
+            std::cout << "  " << std::left << std::setw(14) << layout_name(layout)
+                      << std::right << std::fixed << std::setprecision(1)
+                      << std::setw(8) << ns << " ns/lookup"
+                      << std::setw(8) << std::setprecision(2) << baseline / ns << "x"
+                      << "   build " << std::setprecision(0)
+                      << std::chrono::duration<double, std::milli>(build_end - build_start).count() << " ms"
+                      << "   (checksum " << found % 1000 << ")\n";
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+// Tokenizer throughput per kernel backend, in GB of text per second
+// Usage: tokenizer_bench [text_file] [megabytes]
+// Without a file, text shaped like cleaned post bodies (mixed case words, punctuation, numbers) is generated
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+
+#include "lexicon.hpp"
+#include "tokenizer.hpp"
+
+static std::string generate_text(size_t bytes) {
+    static const char* words[] = {"Ubuntu", "install", "package", "the", "kernel", "boot", "GRUB", "sudo",
+                                  "apt-get", "update", "network", "driver", "error:", "file", "(system)", "a",
+                                  "I", "don't", "16.04", "nvidia-driver-390", "/etc/fstab", "it.", "Thanks!", "is"};
+    std::mt19937_64 rng(42);
+    std::string text;
+    text.reserve(bytes + 64);
+    while (text.size() < bytes) {
+        text += words[rng() % 24];
+        text += rng() % 40 == 0 ? '\n' : ' ';
+    }
+    return text;
+}
+
+struct Result {
+    size_t tokens = 0;
+    size_t checksum = 0;
+    double seconds = 0;
+};
+
+static Result run(const std::string& text) {
+    Result result;
+    auto start = std::chrono::steady_clock::now();
+    Tokenizer tokenizer(text);
+    while (auto token = tokenizer.next()) {
+        result.tokens++;
+        result.checksum += token->size() + static_cast<unsigned char>(token->back());
+    }
+    auto end = std::chrono::steady_clock::now();
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    return result;
+}
+
+int main(int argc, char** argv) {
+    std::string path = argc > 1 ? argv[1] : "";
+    size_t megabytes = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 256;
+
+    std::string text;
+    if (path.empty()) {
+        text = generate_text(megabytes * 1024 * 1024);
+    } else {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            std::cerr << "Could not open " << path << "\n";
+            return 1;
+        }
+        std::ostringstream contents;
+        contents << in.rdbuf();
+        text = contents.str();
+    }
+    double gigabytes = text.size() / 1e9;
+    std::cout << "text: " << text.size() / 1e6 << " MB\n\n";
+
+    double scalar_seconds = 0;
+    size_t expected = 0;
+    for (auto backend : {Tokenizer::Backend::SCALAR, Tokenizer::Backend::SSE2, Tokenizer::Backend::AVX2}) {
+        if (!Tokenizer::set_backend(backend)) {
+            std::cout << "  " << std::left << std::setw(8) << Tokenizer::backend_name(backend) << "not supported\n";
+            continue;
+        }
+        run(text); // Warm up
+        Result result = run(text);
+        if (backend == Tokenizer::Backend::SCALAR) {
+            scalar_seconds = result.seconds;
+            expected = result.checksum;
+        }
+
+        std::cout << "  " << std::left << std::setw(8) << Tokenizer::backend_name(backend)
+                  << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(8) << gigabytes / result.seconds << " GB/s"
+                  << std::setw(8) << result.seconds / gigabytes << " s/GB"
+                  << std::setw(8) << scalar_seconds / result.seconds << "x"
+                  << "   " << result.tokens << " tokens"
+                  << (result.checksum == expected ? "" : "   MISMATCH") << "\n";
+    }
+
+    // The copying wrapper on the fastest backend, for comparison
+    Tokenizer::set_backend(Tokenizer::Backend::AVX2) || Tokenizer::set_backend(Tokenizer::Backend::SSE2);
+    auto start = std::chrono::steady_clock::now();
+    size_t tokens = Lexicon::tokenize_text(text).size();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "\n  tokenize_text (copies) " << std::fixed << std::setprecision(2)
+              << gigabytes / seconds << " GB/s, " << tokens << " tokens\n";
+
+    return 0;
+}
@@ -1,12 +1,26 @@
+#include <algorithm>
+#include <filesystem>
 #include <iostream>
+#include <thread>
 #include "CLI11.hpp"
+#include "comment.hpp"
 #include "compound_key.hpp"
+#include "doc_metadata.hpp"
 #include "forward_index.hpp"
+#include "index_pipeline.hpp"
 #include "isam_storage.hpp"
+#include "post_store.hpp"
 #include "pugixml.hpp"
 #include "reverse_index.hpp"
 #include "utils.hpp"
 
+// The binary lexicon maps instantly, the text one is the fallback for directories indexed before it existed
+static void open_lexicon(Lexicon& lexicon, const std::string& input_dir) {
+    if (!lexicon.open(Lexicon::file_path(input_dir))) {
+        lexicon.load(input_dir + "/lexicon.txt");
+    }
+}
+
 int main(int argc, char** argv) {
     CLI::App app{"The Haystack CLI"};
     argv = app.ensure_utf8(argv);
@@ -27,6 +41,10 @@ int main(int argc, char** argv) {
     app.add_flag("--data-index-show", show_data_index,
                  "Show data index");
 
+    bool gen_metadata = false;
+    app.add_flag("--metadata-gen", gen_metadata,
+                 "Generate the columnar post metadata (scores, counts, dates) from the data index");
+
     bool gen_lexicon = false;
     app.add_flag("--lexicon-gen", gen_lexicon,
                  "Generate lexicon");
@@ -43,6 +61,37 @@ int main(int argc, char** argv) {
     app.add_flag("--reverse-index-gen", gen_reverse_index,
                  "Generate reverse index (Barrels)");
 
+    bool compress = false;
+    app.add_flag("--compress", compress,
+                 "Write new data index, forward index and barrel files as LZ4 compressed blocks");
+
+    bool dict_compress = false;
+    app.add_flag("--dict-compress", dict_compress,
+                 "Compress data index records one by one with a zstd dictionary trained on the posts");
+
+    int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    app.add_option("-j,--threads", threads,
+                   "Worker threads for parsing Posts.xml");
+
+    bool pipeline_build = false;
+    app.add_flag("--pipeline-build", pipeline_build,
+                 "Generate the data index, lexicon, forward index and barrels in one pipelined pass over Posts.xml");
+
+    // Per stage thread counts for --pipeline-build, split from -j when not given
+    int parse_threads = 0;
+    app.add_option("--parse-threads", parse_threads,
+                   "Threads turning rows into posts in --pipeline-build");
+    int clean_threads = 0;
+    app.add_option("--clean-threads", clean_threads,
+                   "Threads stripping HTML from bodies in --pipeline-build");
+    int tokenize_threads = 0;
+    app.add_option("--tokenize-threads", tokenize_threads,
+                   "Threads tokenizing titles and bodies in --pipeline-build");
+
+    bool compact_stores = false;
+    app.add_flag("--compact", compact_stores,
+                 "Compact every index/data file pair in the input directory");
+
     // Number of barrels
     int num_barrels = 1;
     app.add_option("-b,--barrels", num_barrels,
@@ -54,6 +103,10 @@ int main(int argc, char** argv) {
     app.add_option("--search-id", search_word_id,
                    "Search for a WordID using Barrels");
 
+    bool show_results = false;
+    app.add_flag("--show-results", show_results,
+                 "Fetch and print the matching posts from the data index");
+
     // AUTOCOMPLETE OPTIONS 
     bool run_autocomplete = false;
     std::string autocomplete_prefix;
@@ -66,52 +119,87 @@ int main(int argc, char** argv) {
 
     CLI11_PARSE(app, argc, argv);
 
+    // Stores that are only read from are memory mapped
+    ISAMOptions read_only;
+    read_only.use_mmap = true;
+
+    auto compression = compress ? ISAMOptions::Compression::LZ4 : ISAMOptions::Compression::NONE;
+
     //  DATA INDEX 
     if (gen_data_index) {
         std::string path = input_dir + "/Posts.xml";
         std::cout << "Generating data index from: " << path << "\n";
+        ISAMOptions options;
+        options.bloom_bits_per_key = 10;
+        options.compression = compression;
         ISAMStorage data_index(input_dir + "/data_index.idx",
-                               input_dir + "/data_index.dat");
-        Utils::generate_data_index(data_index, path);
+                               input_dir + "/data_index.dat", options);
+        Utils::generate_data_index(data_index, path, dict_compress, threads);
     }
 
     if (show_data_index) {
         ISAMStorage data_index(input_dir + "/data_index.idx",
-                               input_dir + "/data_index.dat");
+                               input_dir + "/data_index.dat", read_only);
+        auto cursor = data_index.cursor();
         while (true) {
-            auto entry = data_index.next();
+            auto entry = cursor.next();
             if (!entry.has_value()) break;
             CompoundKey k = CompoundKey::unpack(entry->first);
             std::cout << "KEY: " << k.to_string() << "\n";
-            std::cout << "DATA: " << entry->second << "\n\n";
+
+            // Binary records are shown as JSON
+            if (auto post = PostView::from_binary(entry->second)) {
+                std::cout << "DATA: " << Post::to_json(post->to_post()).dump(4) << "\n\n";
+            } else if (auto comment = CommentView::from_binary(entry->second)) {
+                std::cout << "DATA: " << Comment::to_json(comment->to_comment()).dump(4) << "\n\n";
+            } else {
+                std::cout << "DATA: " << entry->second << "\n\n";
+            }
         }
     }
 
+    //  METADATA 
+    if (gen_metadata) {
+        std::cout << "Generating document metadata\n";
+        ISAMStorage data_index(input_dir + "/data_index.idx",
+                               input_dir + "/data_index.dat", read_only);
+        DocIdMap doc_ids;
+        if (!doc_ids.load(DocIdMap::file_path(input_dir))) {
+            std::cerr << "Doc numbers are assigned by --reverse-index-gen, run it first\n";
+            return 1;
+        }
+        DocMetadata::generate(input_dir + "/doc_metadata.bin", data_index, doc_ids);
+    }
+
     // LEXICON 
     if (gen_lexicon) {
         std::cout << "Generating lexicon\n";
         ISAMStorage data_index(input_dir + "/data_index.idx",
-                               input_dir + "/data_index.dat");
+                               input_dir + "/data_index.dat", read_only);
         Lexicon l = Utils::generate_lexicon(data_index);
         l.save(input_dir + "/lexicon.txt");
+        l.save_binary(Lexicon::file_path(input_dir));
     }
     //forward index
     if (gen_forward_index) {
         std::cout << "Generating forward index\n";
+        ISAMOptions options;
+        options.compression = compression;
         ISAMStorage forward_index(input_dir + "/forward_index.idx",
-                                  input_dir + "/forward_index.dat");
+                                  input_dir + "/forward_index.dat", options);
         ISAMStorage data_index(input_dir + "/data_index.idx",
-                               input_dir + "/data_index.dat");
+                               input_dir + "/data_index.dat", read_only);
         Lexicon l;
-        l.load(input_dir + "/lexicon.txt");
+        open_lexicon(l, input_dir);
         ForwardIndex::generate(forward_index, data_index, l);
     }
 
     if (show_f_index) {
         ISAMStorage forward_index(input_dir + "/forward_index.idx",
-                                  input_dir + "/forward_index.dat");
+                                  input_dir + "/forward_index.dat", read_only);
+        auto cursor = forward_index.cursor();
         while (true) {
-            auto entry = forward_index.next();
+            auto entry = cursor.next();
             if (!entry.has_value()) break;
             CompoundKey k = CompoundKey::unpack(entry->first);
             std::cout << "KEY: " << k.to_string() << "\n";
@@ -125,14 +213,73 @@ int main(int argc, char** argv) {
                   << num_barrels << " barrels\n";
 
         ISAMStorage forward_index(input_dir + "/forward_index.idx",
-                                  input_dir + "/forward_index.dat");
+                                  input_dir + "/forward_index.dat", read_only);
 
         Lexicon l;
-        l.load(input_dir + "/lexicon.txt");
+        open_lexicon(l, input_dir);
 
         ReverseIndex r(num_barrels);
         r.build(forward_index, l);
-        r.save_barrels(input_dir);
+        r.save_barrels(input_dir, compression);
+    }
+
+    //  PIPELINED BUILD
+    if (pipeline_build) {
+        std::string path = input_dir + "/Posts.xml";
+        std::cout << "Building all indexes from: " << path << " into "
+                  << num_barrels << " barrels\n";
+        if (dict_compress) {
+            std::cout << "--dict-compress needs a pass over the posts before writing, "
+                      << "the data index is written without a dictionary\n";
+        }
+
+        // Cleaning HTML is the most expensive stage, it gets half of the threads
+        IndexPipeline::Options pipeline_options;
+        pipeline_options.parse_threads = parse_threads > 0 ? parse_threads : std::max(1, threads / 4);
+        pipeline_options.clean_threads = clean_threads > 0 ? clean_threads : std::max(1, threads / 2);
+        pipeline_options.tokenize_threads = tokenize_threads > 0 ? tokenize_threads : std::max(1, threads / 4);
+
+        ISAMOptions data_options;
+        data_options.bloom_bits_per_key = 10;
+        data_options.compression = compression;
+        ISAMStorage data_index(input_dir + "/data_index.idx",
+                               input_dir + "/data_index.dat", data_options);
+        ISAMOptions forward_options;
+        forward_options.compression = compression;
+        ISAMStorage forward_index(input_dir + "/forward_index.idx",
+                                  input_dir + "/forward_index.dat", forward_options);
+
+        Lexicon l;
+        ReverseIndex r(num_barrels);
+        if (!IndexPipeline::run(path, data_index, forward_index, l, r, pipeline_options)) {
+            return 1;
+        }
+        l.save(input_dir + "/lexicon.txt");
+        l.save_binary(Lexicon::file_path(input_dir));
+        r.save_barrels(input_dir, compression);
+    }
+
+    // COMPACTION
+    if (compact_stores) {
+        // Every .idx with a .dat next to it is an ISAM store
+        std::vector<std::string> stores;
+        for (const auto& file : std::filesystem::directory_iterator(input_dir)) {
+            auto path = file.path();
+            if (path.extension() != ".idx") continue;
+
+            auto data_path = path;
+            data_path.replace_extension(".dat");
+            if (std::filesystem::exists(data_path)) stores.push_back(path.string());
+        }
+        std::sort(stores.begin(), stores.end());
+
+        std::cout << "Compacting " << stores.size() << " stores\n";
+        for (const auto& idx_path : stores) {
+            std::string dat_path = idx_path.substr(0, idx_path.size() - 4) + ".dat";
+            if (!ISAMStorage::compact(idx_path, dat_path)) {
+                std::cerr << "Compaction failed for " << idx_path << "\n";
+            }
+        }
     }
 
 if (run_autocomplete) {
@@ -146,10 +293,10 @@ if (run_autocomplete) {
 
     // Forward index needed to rebuild in-memory structures
     ISAMStorage forward_index(input_dir + "/forward_index.idx",
-                              input_dir + "/forward_index.dat");
+                              input_dir + "/forward_index.dat", read_only);
 
     Lexicon l;
-    l.load(input_dir + "/lexicon.txt");
+    open_lexicon(l, input_dir);
 
     ReverseIndex r(num_barrels);
     r.build(forward_index, l);   // builds trie + word set
@@ -177,12 +324,42 @@ if (run_autocomplete) {
         auto postings = ReverseIndex::search_barrel(
             input_dir, target_barrel, search_word_id);
 
+        // Barrels written before dense doc numbers have no map and hold post ids
+        DocIdMap doc_ids;
+        bool dense = doc_ids.load(DocIdMap::file_path(input_dir));
+        std::vector<uint64_t> keys;
+        for (auto& p : postings) {
+            if (!dense) {
+                keys.push_back(CompoundKey(static_cast<uint8_t>(KeyType::POST_BY_ID),
+                                           static_cast<uint16_t>(SiteID::ASK_UBUNTU), p.doc_id, 0).pack());
+            } else if (p.doc_id < doc_ids.size()) {
+                keys.push_back(doc_ids.key(p.doc_id));
+            }
+        }
+
         std::cout << "Found " << postings.size()
                   << " documents:\n";
-        for (auto& p : postings) {
-            std::cout << p.doc_id << " ";
+        for (uint64_t key : keys) {
+            std::cout << CompoundKey::unpack(key).primary_id << " ";
         }
         std::cout << "\n";
+
+        if (show_results) {
+            // One batched fetch for the whole result page, only the titles are shown
+            ISAMStorage data_index(input_dir + "/data_index.idx",
+                                   input_dir + "/data_index.dat");
+            PostStore posts(data_index);
+
+            std::sort(keys.begin(), keys.end());
+            keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+            std::vector<std::string> scratch;
+            for (const auto& post : posts.read_fields_many(keys, {PostStore::TITLE}, scratch, 4)) {
+                if (!post.has_value()) continue;
+                std::cout << post->post_id() << " | "
+                          << (post->post_type_id() == 1 ? post->title() : "(answer)") << "\n";
+            }
+        }
     }
 
     return 0;
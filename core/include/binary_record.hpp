@@ -0,0 +1,67 @@
+#ifndef BINARY_RECORD_HPP
+#define BINARY_RECORD_HPP
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+
+// Helpers for the binary Post and Comment records
+// Layout: [magic][version][optional field bits][0][fixed-width numeric fields...]
+//         [end offset of every string (u32)][string bytes...]
+// Numbers sit at fixed offsets, string i spans [end of string i-1, end of string i) with the first one
+// starting right after the offset table, so any field is reachable without parsing the others.
+// The magic byte never starts a JSON document, which is how readers tell both formats apart
+class BinaryRecord {
+public:
+    static constexpr uint8_t POST_MAGIC = 0xB1;
+    static constexpr uint8_t COMMENT_MAGIC = 0xB2;
+    static constexpr uint8_t VERSION = 1;
+
+    static bool has_magic(std::string_view record, uint8_t magic) {
+        return record.size() >= 2 && static_cast<uint8_t>(record[0]) == magic &&
+               static_cast<uint8_t>(record[1]) == VERSION;
+    }
+
+    template<typename T>
+    static void put(std::string& out, size_t pos, T value) {
+        std::memcpy(&out[pos], &value, sizeof(T));
+    }
+
+    template<typename T>
+    static T get(std::string_view record, size_t pos) {
+        T value;
+        std::memcpy(&value, record.data() + pos, sizeof(T));
+        return value;
+    }
+
+    // Appends a string to a record whose offset table starts at table_pos, index counts from 0
+    static void append_string(std::string& out, size_t table_pos, size_t index, std::string_view s) {
+        out.append(s.data(), s.size());
+        put<uint32_t>(out, table_pos + index * sizeof(uint32_t), static_cast<uint32_t>(out.size()));
+    }
+
+    // Checks that count strings fit the record and their offsets only grow, done once before a view is used
+    static bool check_strings(std::string_view record, size_t table_pos, size_t count) {
+        size_t start = table_pos + count * sizeof(uint32_t);
+        if (record.size() < start) return false;
+
+        size_t previous = start;
+        for (size_t i = 0; i < count; i++) {
+            size_t end = get<uint32_t>(record, table_pos + i * sizeof(uint32_t));
+            if (end < previous || end > record.size()) return false;
+            previous = end;
+        }
+        return true;
+    }
+
+    static std::string_view string_at(std::string_view record, size_t table_pos, size_t count, size_t index) {
+        size_t start = index == 0 ? table_pos + count * sizeof(uint32_t)
+                                  : get<uint32_t>(record, table_pos + (index - 1) * sizeof(uint32_t));
+        size_t end = get<uint32_t>(record, table_pos + index * sizeof(uint32_t));
+        return record.substr(start, end - start);
+    }
+};
+
+
+#endif //BINARY_RECORD_HPP
@@ -0,0 +1,93 @@
+#ifndef BLOCK_CACHE_HPP
+#define BLOCK_CACHE_HPP
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// Counters of a BlockCache, a snapshot taken by BlockCache::stats()
+struct BlockCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t bytes_read = 0; // Bytes fetched from disk to serve misses
+    uint64_t evictions = 0;
+    uint64_t inserts = 0;
+    size_t bytes_cached = 0;
+    size_t capacity = 0;
+};
+
+// Size-bounded cache of data blocks (records, or compressed blocks once decoded)
+// One cache can be shared by any number of ISAMStorage instances and threads through ISAMOptions::block_cache,
+// entries are keyed by (file id, offset) so instances opened on the same file share entries.
+//
+// Eviction is a segmented LRU: new blocks enter a probation segment and only move to the protected
+// segment (80% of the capacity) when they are hit again. A long sequential scan therefore only churns
+// probation and never pushes out the hot blocks in protected.
+// The cache is split into shards with their own lock to keep contention low
+class BlockCache {
+public:
+    explicit BlockCache(size_t capacity_bytes);
+
+    using block_t = std::shared_ptr<const std::string>;
+
+    // Returns nullptr on a miss, the block stays valid while the caller holds it even if it gets evicted
+    block_t get(uint64_t file_id, uint64_t offset);
+
+    // Blocks larger than an eighth of a shard are not cached
+    void put(uint64_t file_id, uint64_t offset, block_t block);
+
+    // Account for bytes that had to be read from disk
+    void record_read(size_t bytes) { bytes_read.fetch_add(bytes, std::memory_order_relaxed); }
+
+    BlockCacheStats stats() const;
+
+    void reset_stats();
+
+    // Identifies a file on disk, a file replaced by compaction gets a different id
+    static uint64_t file_id(const std::string& path);
+
+private:
+    struct Entry {
+        uint64_t file_id;
+        uint64_t offset;
+        block_t block;
+        bool is_protected;
+    };
+
+    struct Shard {
+        std::mutex lock;
+        std::list<Entry> probation; // Front is most recently used
+        std::list<Entry> protected_;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> entries;
+        size_t probation_bytes = 0;
+        size_t protected_bytes = 0;
+    };
+
+    static constexpr size_t SHARD_COUNT = 16;
+
+    size_t shard_capacity;
+    size_t protected_capacity;
+    mutable std::vector<Shard> shards;
+
+    std::atomic<uint64_t> hits {0};
+    std::atomic<uint64_t> misses {0};
+    std::atomic<uint64_t> bytes_read {0};
+    std::atomic<uint64_t> evictions {0};
+    std::atomic<uint64_t> inserts {0};
+
+    static uint64_t hash_key(uint64_t file_id, uint64_t offset);
+
+    Shard& shard_for(uint64_t hash);
+
+    // Evicts from probation (then protected) until the shard fits, the shard lock must be held
+    void evict(Shard& shard);
+};
+
+
+#endif //BLOCK_CACHE_HPP
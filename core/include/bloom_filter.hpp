@@ -0,0 +1,83 @@
+#ifndef BLOOM_FILTER_HPP
+#define BLOOM_FILTER_HPP
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+
+// Blocked Bloom filter over 64 bit keys
+// All bits of a key land in one 64 byte block, a probe costs a single cache miss (or one small read).
+// At 10 bits per key roughly 1% of missing keys still report a possible match
+class BloomFilter {
+public:
+    BloomFilter() = default;
+
+    BloomFilter(size_t expected_keys, uint32_t bits_per_key);
+
+    void add(uint64_t key);
+
+    // False means the key was never added, true means it may have been
+    bool may_contain(uint64_t key) const;
+
+    uint32_t get_bits_per_key() const { return bits_per_key; }
+
+    static std::string file_path(const std::string& index_file) { return index_file + ".bloom"; }
+
+    static constexpr uint64_t MAGIC = 0x4853544B424C4D31ULL; // "HSTKBLM1"
+    static constexpr size_t BLOCK_WORDS = 8;
+    static constexpr size_t HEADER_SIZE = 4 * sizeof(uint64_t);
+
+private:
+    uint64_t block_count = 0;
+    uint32_t probes = 0;
+    uint32_t bits_per_key = 0;
+    std::vector<uint64_t> words;
+
+    friend class BloomFilterSet;
+
+    static uint64_t hash(uint64_t key);
+
+    static bool block_contains(const uint64_t* block, uint64_t hash, uint32_t probes);
+};
+
+
+// The filters of one ISAM store, <index>.bloom keeps one filter per index segment:
+//   [MAGIC][index file size after the segment][block count][probes | bits per key << 32][blocks...]
+// The set only counts if its last filter ends exactly at the current index size, a store written
+// without filters or with a torn write behaves as if it had none
+class BloomFilterSet {
+public:
+    // False if the file is missing or out of date, may_contain() then always returns true
+    bool load(const std::string& bloom_file, uint64_t index_size);
+
+    void clear();
+
+    bool is_loaded() const { return loaded; }
+
+    // True if any of the filters may hold the key
+    bool may_contain(uint64_t key) const;
+
+    // Bits per key of the newest filter, 0 if none is loaded
+    uint32_t get_bits_per_key() const;
+
+    // Adds the filter of a freshly written segment that ends the index at index_end
+    bool append(const std::string& bloom_file, BloomFilter filter, uint64_t index_end);
+
+    // Replaces the whole file with a single filter
+    bool reset(const std::string& bloom_file, BloomFilter filter, uint64_t index_end);
+
+    // Checks a key against a filter file without loading it, reads one block per filter.
+    // True unless the file is valid and rules the key out
+    static bool file_may_contain(const std::string& bloom_file, uint64_t index_size, uint64_t key);
+
+private:
+    std::vector<BloomFilter> filters;
+    bool loaded = false;
+
+    static bool write_filter(std::ofstream& out, const BloomFilter& filter, uint64_t index_end);
+};
+
+
+#endif //BLOOM_FILTER_HPP
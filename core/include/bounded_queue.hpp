@@ -0,0 +1,126 @@
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+
+// Bounded lock-free multi-producer multi-consumer queue (Dmitry Vyukov's array queue)
+// Every cell carries a sequence number that tells producers and consumers whose turn it is, so a push or
+// pop is one CAS on the shared position plus a store to the cell, with no locks held.
+// push() and pop() wait by spinning, then yielding, then sleeping briefly, which keeps idle pipeline
+// stages off the CPU. A closed queue still hands out what it holds, then pop() returns false
+template <typename T>
+class BoundedQueue {
+public:
+    // The capacity is rounded up to a power of two
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        mask = size - 1;
+        cells = std::make_unique<Cell[]>(size);
+        for (size_t i = 0; i < size; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // Moves value in and returns true, false if the queue is full (value is untouched then)
+    bool try_push(T& value) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Moves the oldest value out and returns true, false if the queue is empty
+    bool try_pop(T& value) {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.value);
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Waits for a free cell
+    void push(T value) {
+        Backoff backoff;
+        while (!try_push(value)) backoff.wait();
+    }
+
+    // Waits for a value, false once the queue is closed and empty
+    bool pop(T& value) {
+        Backoff backoff;
+        while (!try_pop(value)) {
+            // Everything pushed before close() is visible once closed is, one more look picks it up
+            if (closed.load(std::memory_order_acquire)) return try_pop(value);
+            backoff.wait();
+        }
+        return true;
+    }
+
+    // No more pushes will follow
+    void close() { closed.store(true, std::memory_order_release); }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    struct Backoff {
+        unsigned rounds = 0;
+
+        void wait() {
+            if (rounds < 64) {
+                rounds++;
+            } else if (rounds < 128) {
+                rounds++;
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+
+    // Producers and consumers each hammer their own position, keep them on separate cache lines
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    alignas(64) std::atomic<size_t> dequeue_pos{0};
+    alignas(64) std::atomic<bool> closed{false};
+};
+
+
+#endif //BOUNDED_QUEUE_HPP
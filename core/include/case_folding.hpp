@@ -0,0 +1,22 @@
+#ifndef CASE_FOLDING_HPP
+#define CASE_FOLDING_HPP
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+
+// Unicode simple case folding, so "Ärger", "ÄRGER" and "ärger" or "Σ", "σ" and "ς" become one word
+// Mappings come from the Unicode 14 case folding data, one code point to one code point. Full foldings
+// that change the length ("ß" to "ss") are left out, as are normalization forms: text is not composed or
+// decomposed, only folded
+class CaseFolding {
+public:
+    // Folded code point, the code point itself if it has no folding
+    static uint32_t fold(uint32_t code_point);
+
+    // Appends the folded UTF-8 text to out. Bytes that are not valid UTF-8 are copied as they are
+    static void fold_utf8(std::string_view text, std::string& out);
+};
+
+
+#endif //CASE_FOLDING_HPP
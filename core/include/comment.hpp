@@ -1,8 +1,10 @@
 #ifndef COMMENT_HPP
 #define COMMENT_HPP
 #include <optional>
+#include <string_view>
 #include <nlohmann/json.hpp>
 
+#include "binary_record.hpp"
 #include "compound_key.hpp"
 
 class Comment {
@@ -27,6 +29,9 @@ public:
     Comment() : site_id(SiteID::ASK_UBUNTU), comment_id(0), post_id(0), score(0) {
     }
 
+    // Compact binary form, read back through CommentView
+    static std::string to_binary(const Comment &comment);
+
     // Serialization functions
     static nlohmann::json to_json(const Comment &comment) {
         return nlohmann::json{
@@ -61,4 +66,88 @@ public:
     }
 };
 
+
+// Read-only view of a binary comment record, see PostView
+class CommentView {
+public:
+    // Fixed part of the record, see BinaryRecord for the overall layout
+    static constexpr size_t FLAGS_OFFSET = 2;
+    static constexpr size_t SITE_ID_OFFSET = 4;
+    static constexpr size_t COMMENT_ID_OFFSET = 8;
+    static constexpr size_t POST_ID_OFFSET = 12;
+    static constexpr size_t USER_ID_OFFSET = 16;
+    static constexpr size_t SCORE_OFFSET = 20;
+    static constexpr size_t STRING_TABLE_OFFSET = 24;
+
+    static constexpr uint8_t HAS_USER_ID = 1;
+
+    enum StringField : uint8_t {
+        TEXT,
+        CREATION_DATE,
+        STRING_FIELD_COUNT
+    };
+
+    // Empty if the bytes are not a complete binary comment
+    static std::optional<CommentView> from_binary(std::string_view record) {
+        if (!BinaryRecord::has_magic(record, BinaryRecord::COMMENT_MAGIC) ||
+            !BinaryRecord::check_strings(record, STRING_TABLE_OFFSET, STRING_FIELD_COUNT)) {
+            return std::nullopt;
+        }
+        return CommentView(record);
+    }
+
+    SiteID site_id() const { return static_cast<SiteID>(BinaryRecord::get<uint16_t>(record, SITE_ID_OFFSET)); }
+    uint32_t comment_id() const { return BinaryRecord::get<uint32_t>(record, COMMENT_ID_OFFSET); }
+    uint32_t post_id() const { return BinaryRecord::get<uint32_t>(record, POST_ID_OFFSET); }
+
+    std::optional<uint32_t> user_id() const {
+        if ((static_cast<uint8_t>(record[FLAGS_OFFSET]) & HAS_USER_ID) == 0) return std::nullopt;
+        return BinaryRecord::get<uint32_t>(record, USER_ID_OFFSET);
+    }
+
+    int32_t score() const { return BinaryRecord::get<int32_t>(record, SCORE_OFFSET); }
+
+    std::string_view text() const {
+        return BinaryRecord::string_at(record, STRING_TABLE_OFFSET, STRING_FIELD_COUNT, TEXT);
+    }
+    std::string_view creation_date() const {
+        return BinaryRecord::string_at(record, STRING_TABLE_OFFSET, STRING_FIELD_COUNT, CREATION_DATE);
+    }
+
+    Comment to_comment() const {
+        Comment comment;
+        comment.site_id = site_id();
+        comment.comment_id = comment_id();
+        comment.post_id = post_id();
+        comment.text = text();
+        comment.user_id = user_id();
+        comment.score = score();
+        comment.creation_date = creation_date();
+        return comment;
+    }
+
+private:
+    explicit CommentView(std::string_view record) : record(record) {}
+
+    std::string_view record;
+};
+
+
+inline std::string Comment::to_binary(const Comment &comment) {
+    std::string out(CommentView::STRING_TABLE_OFFSET + CommentView::STRING_FIELD_COUNT * sizeof(uint32_t), '\0');
+    out[0] = static_cast<char>(BinaryRecord::COMMENT_MAGIC);
+    out[1] = static_cast<char>(BinaryRecord::VERSION);
+    out[CommentView::FLAGS_OFFSET] = static_cast<char>(comment.user_id ? CommentView::HAS_USER_ID : 0);
+
+    BinaryRecord::put<uint16_t>(out, CommentView::SITE_ID_OFFSET, static_cast<uint16_t>(comment.site_id));
+    BinaryRecord::put<uint32_t>(out, CommentView::COMMENT_ID_OFFSET, comment.comment_id);
+    BinaryRecord::put<uint32_t>(out, CommentView::POST_ID_OFFSET, comment.post_id);
+    BinaryRecord::put<uint32_t>(out, CommentView::USER_ID_OFFSET, comment.user_id.value_or(0));
+    BinaryRecord::put<int32_t>(out, CommentView::SCORE_OFFSET, comment.score);
+
+    BinaryRecord::append_string(out, CommentView::STRING_TABLE_OFFSET, CommentView::TEXT, comment.text);
+    BinaryRecord::append_string(out, CommentView::STRING_TABLE_OFFSET, CommentView::CREATION_DATE, comment.creation_date);
+    return out;
+}
+
 #endif //COMMENT_HPP
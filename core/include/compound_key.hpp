@@ -16,6 +16,16 @@ enum class SiteID :uint16_t {
     // More can be added
 };
 
+// Inclusive range of packed keys, lower <= key <= upper
+struct KeyRange {
+    uint64_t lower;
+    uint64_t upper;
+
+    constexpr bool contains(uint64_t key) const {
+        return lower <= key && key <= upper;
+    }
+};
+
 class CompoundKey {
 public:
     // These 4 attributes are combined to index posts
@@ -36,6 +46,18 @@ public:
     // Converts 64 bit number back to attribute
     static CompoundKey unpack(uint64_t);
 
+    // Key ranges for scans, every key of the type (and site) falls inside
+    // Evaluated at compile time when the arguments are constants
+    static constexpr KeyRange range(KeyType key_type) {
+        return {static_cast<uint64_t>(key_type) << 56,
+                (static_cast<uint64_t>(key_type) << 56) | 0x00FFFFFFFFFFFFFFULL};
+    }
+
+    static constexpr KeyRange range(KeyType key_type, SiteID site_id) {
+        return {(static_cast<uint64_t>(key_type) << 56) | (static_cast<uint64_t>(site_id) << 40),
+                (static_cast<uint64_t>(key_type) << 56) | (static_cast<uint64_t>(site_id) << 40) | 0xFFFFFFFFFFULL};
+    }
+
 
 
     // Comparison operators, will be useful
@@ -52,5 +74,12 @@ public:
     }
 };
 
+// Compile-time key range of each KeyType, e.g. key_range_v<KeyType::POST_BY_ID>
+template <KeyType key_type>
+inline constexpr KeyRange key_range_v = CompoundKey::range(key_type);
+
+static_assert(key_range_v<KeyType::POST_BY_ID>.upper < key_range_v<KeyType::COMMENT_BY_ID>.lower,
+              "Key types must occupy disjoint ranges");
+
 
 #endif //COMPOSITE_KEY_H
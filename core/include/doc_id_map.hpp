@@ -0,0 +1,48 @@
+#ifndef DOC_ID_MAP_HPP
+#define DOC_ID_MAP_HPP
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+
+// Dense internal doc numbers 0..N-1 for the documents of an index, both ways
+// Numbers are handed out in key order, so one sorted array of packed CompoundKeys serves
+// doc number -> key (index) and key -> doc number (binary search), and posting lists built in
+// key order stay sorted by doc number.
+// File layout: [MAGIC][count][key (u64)]*count
+class DocIdMap {
+public:
+    static constexpr uint64_t MAGIC = 0x4853544B444F4353;  // "HSTKDOCS"
+
+    // Where the indexer keeps the map, next to the barrels
+    static std::string file_path(const std::string& directory) { return directory + "/doc_ids.bin"; }
+
+    // Doc number of the next document, keys have to come in increasing order.
+    // The last key again returns its existing number, an older key returns nothing
+    std::optional<uint32_t> add(uint64_t key);
+
+    void clear() { keys.clear(); }
+
+    size_t size() const { return keys.size(); }
+
+    bool empty() const { return keys.empty(); }
+
+    // Packed CompoundKey of a doc number below size()
+    uint64_t key(uint32_t doc) const { return keys[doc]; }
+
+    // Doc number of a packed CompoundKey, may find nothing
+    std::optional<uint32_t> doc_number(uint64_t key) const;
+
+    // Returns true on success, false on failure
+    bool save(const std::string& path) const;
+
+    // Returns true on success, false on failure
+    bool load(const std::string& path);
+
+private:
+    std::vector<uint64_t> keys;
+};
+
+
+#endif //DOC_ID_MAP_HPP
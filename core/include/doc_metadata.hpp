@@ -0,0 +1,82 @@
+#ifndef DOC_METADATA_HPP
+#define DOC_METADATA_HPP
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "doc_id_map.hpp"
+#include "isam_storage.hpp"
+#include "mapped_file.hpp"
+
+
+// Columnar side store of the numeric post fields used for ranking and filtering
+// Row n belongs to doc number n of the DocIdMap saved with the barrels, every column is a fixed-width
+// array so a value is one load and a scan over candidates runs at memory bandwidth.
+// Layout: [MAGIC][row count][column...] with every column starting 8-byte aligned in the order
+//         post_id, parent_id, score, view_count, answer_count, comment_count (u32/i32),
+//         creation_date, last_activity_date (i64 seconds since the epoch, 0 if unknown), post_type_id (u8)
+// The file is memory mapped, opening costs nothing beyond a header check
+class DocMetadata {
+public:
+    static constexpr uint64_t MAGIC = 0x4853544B4D455441;  // "HSTKMETA"
+    static constexpr size_t HEADER_SIZE = 16;
+
+    // Writes one row per doc number, returns false if the file could not be written
+    // Documents missing from the data index get a row of zeros
+    static bool generate(const std::string& path, const ISAMStorage& data_index, const DocIdMap& doc_ids);
+
+    // Seconds since the epoch (UTC) of a Stack Exchange date like 2010-07-28T19:04:21.300, 0 if it does not parse
+    static int64_t parse_date(std::string_view date);
+
+    // Returns true on success, false on failure
+    bool open(const std::string& path);
+
+    void close();
+
+    bool is_open() const { return file.is_open(); }
+
+    // Number of rows, doc numbers run from 0 to size() - 1
+    size_t size() const { return rows; }
+
+    uint32_t post_id(uint32_t doc) const { return post_ids[doc]; }
+    uint8_t post_type_id(uint32_t doc) const { return post_type_ids[doc]; }
+    std::optional<uint32_t> parent_id(uint32_t doc) const {
+        return parent_ids[doc] == 0 ? std::nullopt : std::optional<uint32_t>(parent_ids[doc]);
+    }
+    int32_t score(uint32_t doc) const { return scores[doc]; }
+    uint32_t view_count(uint32_t doc) const { return view_counts[doc]; }
+    uint32_t answer_count(uint32_t doc) const { return answer_counts[doc]; }
+    uint32_t comment_count(uint32_t doc) const { return comment_counts[doc]; }
+    int64_t creation_date(uint32_t doc) const { return creation_dates[doc]; }
+    int64_t last_activity_date(uint32_t doc) const { return last_activity_dates[doc]; }
+
+    // Whole columns, size() values each
+    const uint32_t* post_id_column() const { return post_ids; }
+    const uint8_t* post_type_id_column() const { return post_type_ids; }
+    const uint32_t* parent_id_column() const { return parent_ids; }
+    const int32_t* score_column() const { return scores; }
+    const uint32_t* view_count_column() const { return view_counts; }
+    const uint32_t* answer_count_column() const { return answer_counts; }
+    const uint32_t* comment_count_column() const { return comment_counts; }
+    const int64_t* creation_date_column() const { return creation_dates; }
+    const int64_t* last_activity_date_column() const { return last_activity_dates; }
+
+private:
+    MappedFile file;
+    size_t rows = 0;
+
+    const uint32_t* post_ids = nullptr;
+    const uint32_t* parent_ids = nullptr;
+    const int32_t* scores = nullptr;
+    const uint32_t* view_counts = nullptr;
+    const uint32_t* answer_counts = nullptr;
+    const uint32_t* comment_counts = nullptr;
+    const int64_t* creation_dates = nullptr;
+    const int64_t* last_activity_dates = nullptr;
+    const uint8_t* post_type_ids = nullptr;
+};
+
+
+#endif //DOC_METADATA_HPP
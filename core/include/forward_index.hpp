@@ -17,7 +17,7 @@ enum class HitMask: int {
 
 class ForwardIndex {
     public:
-    static void generate(ISAMStorage& output_store, ISAMStorage& data_index, Lexicon& lexicon);
+    static void generate(ISAMStorage& output_store, const ISAMStorage& data_index, Lexicon& lexicon);
 
 };
 
@@ -0,0 +1,22 @@
+#ifndef HTML_ENTITIES_HPP
+#define HTML_ENTITIES_HPP
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+
+// Character references in HTML text: all named entities of HTML 4 plus &apos;, and decimal (&#233;) and
+// hexadecimal (&#xE9;) references
+class HtmlEntities {
+public:
+    // Code point of a named entity given without '&' and ';' ("eacute"), 0 if there is no such entity
+    static uint32_t lookup(std::string_view name);
+
+    // Decodes the reference at the start of text (text[0] is '&') into code_point. Returns the number of
+    // bytes it takes up including the ';', 0 if text does not start with a complete known reference.
+    // Numeric references outside of Unicode, surrogates and &#0; decode to U+FFFD
+    static size_t decode(std::string_view text, uint32_t& code_point);
+};
+
+
+#endif //HTML_ENTITIES_HPP
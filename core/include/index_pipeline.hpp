@@ -0,0 +1,46 @@
+#ifndef INDEX_PIPELINE_HPP
+#define INDEX_PIPELINE_HPP
+#include <cstddef>
+#include <string>
+
+#include "compound_key.hpp"
+#include "isam_storage.hpp"
+#include "lexicon.hpp"
+#include "reverse_index.hpp"
+
+
+// Builds the data index, lexicon, forward index and reverse index in one pass over Posts.xml
+// Stages run on their own threads and hand batches of posts along through bounded lock-free queues:
+//   read     (1 thread)  cuts the file into chunks of whole rows
+//   parse    (N threads) turns rows into posts
+//   clean    (N threads) strips the HTML of the bodies
+//   tokenize (N threads) splits titles and bodies into normalized tokens
+//   index    (calling thread) puts the batches back into file order, assigns term ids, writes the data
+//            and forward records and inverts them into the barrels
+// Term ids are handed out in the same order as the separate passes (--lexicon-gen and so on) as long as
+// Posts.xml is sorted by Id, which is how the dumps come. One difference remains: forward records are
+// written while the lexicon is still growing, so a word of a post that is neither a question nor an
+// answer gets id 0 there if the question or answer that adds it to the lexicon comes later in the file.
+// The separate passes look it up in the finished lexicon and give it its real id
+class IndexPipeline {
+public:
+    struct Options {
+        int parse_threads = 1;
+        int clean_threads = 1;
+        int tokenize_threads = 1;
+
+        // Batches allowed between two stages
+        size_t queue_capacity = 64;
+
+        SiteID site_id = SiteID::ASK_UBUNTU;
+    };
+
+    // Fills the (empty) stores, lexicon and reverse index, the caller saves the lexicon and the barrels.
+    // Returns false if the input could not be read or is not sorted by post id, the stores are then left
+    // as they were and the caller should not save the lexicon or the barrels
+    static bool run(const std::string& post_file, ISAMStorage& data_index, ISAMStorage& forward_index,
+                    Lexicon& lexicon, ReverseIndex& reverse_index, const Options& options);
+};
+
+
+#endif //INDEX_PIPELINE_HPP
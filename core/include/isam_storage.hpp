@@ -1,59 +1,325 @@
 #ifndef ISAM_STORAGE_H
 #define ISAM_STORAGE_H
 #include <cstdint>
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 #include "fstream"
 
+#include "block_cache.hpp"
+#include "bloom_filter.hpp"
 #include "compound_key.hpp"
+#include "key_index.hpp"
+#include "mapped_file.hpp"
+#include "random_access_file.hpp"
+#include "record_dictionary.hpp"
 
 
+// Per-store settings, the defaults keep the original stream based behaviour
+struct ISAMOptions {
+    enum class Compression : uint8_t {
+        NONE, // Plain length-prefixed records
+        LZ4,  // Records packed into LZ4 compressed blocks
+    };
+
+    // Map the index and data files into memory, record views then point straight into the mapping
+    bool use_mmap = false;
+
+    // Search structure built over the in-memory index, see KeyIndex
+    KeyIndex::Layout lookup_layout = KeyIndex::Layout::BINARY;
+
+    // When non-zero only every Nth key is kept in memory and leaf pages are read on demand, see SparseKeyIndex
+    // Needs a single-segment index (fresh or compacted), otherwise the full index is loaded.
+    // A write turns the store back into a fully loaded one
+    uint32_t sparse_index_interval = 0;
+
+    // Format of a data file created by this store, an existing data file keeps the format it was written with
+    Compression compression = Compression::NONE;
+
+    // Uncompressed bytes of records per block, at most MAX_COMPRESSION_BLOCK. Larger blocks compress
+    // better, smaller ones make a single-record read cheaper
+    uint32_t compression_block_size = 32 * 1024;
+
+    // Records read through pread, decompressed blocks of a compressed store and sparse index leaf pages
+    // read through pread are kept here. One cache can be given to many stores. Stores in mmap mode only
+    // use it for compressed blocks, the mapping is served from the page cache already
+    std::shared_ptr<BlockCache> block_cache;
+
+    // Writes keep a Bloom filter of all keys in <index>.bloom so lookups of missing keys skip the index.
+    // With 0 no filter is created, but one that already exists is kept up to date
+    uint32_t bloom_bits_per_key = 0;
+};
+
 // ISAM Data Storage, maps 64 bit keys + offsets to string data
 // Provides a (relatively) easy abstraction to store/access data in an ISAM style
+//
+// The index file is a log of segments, every write() appends one:
+//   [SEGMENT_MAGIC][entry count][(key, offset) * count], entries sorted by key
+// Loading merges all segments into one sorted view, for duplicate keys the newest entry wins
+//
+// A compressed data file starts with [DATA_MAGIC][block size] followed by blocks of
+//   [compressed size][uncompressed size][LZ4 data]
+// holding length-prefixed records. Index offsets are then (block file offset << 16 | record offset in block),
+// a single-record read decompresses just its block
+//
+// A dictionary compressed data file starts with [DICT_DATA_MAGIC][dictionary id], every record is a zstd frame
+// compressed against the dictionary in <data file>.dict, see set_dictionary()
+//
+// All const member functions (reads and cursors) are safe to call from many threads at once without locks,
+// records are fetched with pread or from the mapping so there is no shared file position.
+// Writes must not run concurrently with anything else on the same store
 class ISAMStorage {
 public:
+    // Streaming writer for large loads, obtained through bulk_writer()
+    // Records go straight to the data file as they arrive, only the index entries are buffered.
+    // Once the buffer reaches its budget it is sorted and spilled to a run file next to the index,
+    // finish() merges all runs straight into a single new index segment, entry by entry
+    class BulkWriter {
+    public:
+        BulkWriter(const BulkWriter&) = delete;
+        BulkWriter& operator=(const BulkWriter&) = delete;
+
+        ~BulkWriter(); // Calls finish() if it was not called yet
+
+        // A key appended more than once keeps its last record
+        void append(uint64_t key, std::string_view bytes);
+
+        // Commits everything appended so far, the writer can't be used afterwards
+        void finish();
+
+        // Drops everything appended so far: the data file is cut back to its size when the writer was
+        // created and the run files are removed. The writer can't be used afterwards
+        void abort();
+
+        uint64_t count() const { return appended; }
+
+    private:
+        friend class ISAMStorage;
+
+        BulkWriter(ISAMStorage& store, size_t memory_budget);
+
+        ISAMStorage& store;
+        size_t max_buffered;
+        uint64_t start_data_end;
+        size_t start_pending_block;
+        uint64_t appended = 0;
+        bool finished = false;
+
+        std::vector<std::pair<uint64_t, uint64_t> > buffer;
+        std::vector<std::string> run_files;
+
+        void spill();
+
+        void remove_runs();
+
+        uint64_t merge_runs(std::ofstream& out, BloomFilter* filter);
+    };
+
     // Requires valid path to index and data files
-    ISAMStorage(std::string index_file, std::string data_file);
+    ISAMStorage(std::string index_file, std::string data_file, ISAMOptions options = ISAMOptions());
 
     ~ISAMStorage(); // File descriptors released here
 
-    // Write multiple entries into the files
-    void write(std::vector<std::pair<uint64_t, std::string > > entries);
+    // Write multiple entries into the files, existing keys are replaced
+    void write(const std::vector<std::pair<uint64_t, std::string > >& entries);
+
+    // Start a streaming load that holds at most memory_budget bytes of index entries at a time.
+    // Afterwards the store loads its index like it does on open, with sparse_index_interval only the top level
+    BulkWriter bulk_writer(size_t memory_budget = 64 * 1024 * 1024);
+
+    // Compresses every record written from now on with the dictionary, which is saved next to the data file.
+    // Only possible while the store holds no records, returns false otherwise
+    bool set_dictionary(std::shared_ptr<const RecordDictionary> new_dictionary);
 
-    uint32_t size();
+    uint32_t size() const;
 
-    // Bring iterator for next() back to beginning of index file
-    void reset_iterator();
+    // Walks the store (or a key range of it) in key order, every cursor has its own position and read buffer
+    class Cursor {
+    public:
+        // The view stays valid until the next call on this cursor (or a write to the store)
+        std::optional<std::pair<uint64_t, std::string_view > > next();
 
-    // Get next entry from the files
-    std::optional<std::pair<uint64_t, std::string > > next();
+    private:
+        friend class ISAMStorage;
+
+        Cursor(const ISAMStorage& store, size_t position, size_t end) : store(&store), position(position), end(end) {}
+
+        const ISAMStorage* store;
+        size_t position;
+        size_t end; // Position of the first entry past the range
+        std::string scratch;
+
+        // Sparse stores hand out index entries a leaf page at a time
+        std::vector<std::pair<uint64_t, uint64_t> > page;
+        size_t page_start = 0;
+
+        // Compressed stores keep the current block, neighbouring keys usually share it
+        BlockCache::block_t block;
+        uint64_t block_offset = 0;
+    };
+
+    // Get a cursor positioned at the first entry
+    Cursor cursor() const;
+
+    // Cursor over the keys in [lower, upper], it starts at the first match without touching earlier entries
+    Cursor scan(uint64_t lower, uint64_t upper) const;
+    Cursor scan(KeyRange range) const;
+
+    // Cursor over all keys of a type, or of a type for one site, e.g. all POST_BY_ID keys of a site
+    Cursor scan_prefix(KeyType key_type) const;
+    Cursor scan_prefix(KeyType key_type, SiteID site_id) const;
 
     // Get the data for a specific index, may find nothing
-    std::optional<std::pair<uint64_t, std::string > > read(uint64_t key);
+    std::optional<std::pair<uint64_t, std::string > > read(uint64_t key) const;
+
+    // Zero-copy version of read()
+    // The view points into the mapping (mmap mode) or into scratch (stream mode),
+    // it stays valid until scratch is reused or the store is written to
+    std::optional<std::pair<uint64_t, std::string_view > > read_view(uint64_t key, std::string& scratch) const;
 
+    // Bytes [pos, pos + length) of the record stored under key, shorter if the record ends first.
+    // Plain stores read only those bytes, compressed stores have to decode the whole record (or block) first.
+    // The view points into the mapping or into scratch like read_view()
+    std::optional<std::string_view> read_slice(uint64_t key, uint64_t pos, size_t length, std::string& scratch) const;
 
+    // True if read_slice() touches only the requested bytes
+    bool supports_partial_reads() const { return !compressed && !dictionary_compressed; }
+
+    // Batched read(), results come back in the order of the keys.
+    // Fetches are sorted by file offset and records close to each other are read with one larger read,
+    // the merged ranges can be spread over several threads
+    std::vector<std::optional<std::pair<uint64_t, std::string > > > read_many(const uint64_t* keys, size_t count,
+                                                                              int threads = 1) const;
+    std::vector<std::optional<std::pair<uint64_t, std::string > > > read_many(const std::vector<uint64_t>& keys,
+                                                                              int threads = 1) const;
+
+    // Rewrites a store so it holds only the latest record per key, in key order, with a single index segment.
+    // The new files replace the old ones through renames guarded by a commit marker, an interrupted
+    // compaction is rolled forward or discarded the next time the store is opened.
+    // No ISAMStorage may have the files open while this runs. Returns true on success
+    static bool compact(const std::string& index_file, const std::string& data_file);
+
+    // Records whose offsets are at most this far apart are fetched with one read
+    static constexpr uint64_t READ_MERGE_GAP = 64 * 1024;
+    // Bytes read past the start of the last record of a range, usually enough to cover it
+    static constexpr uint64_t READ_AHEAD = 4 * 1024;
+
+
+    static constexpr uint64_t SEGMENT_MAGIC = 0x4853544B53454731ULL; // "HSTKSEG1"
+    static constexpr size_t SEGMENT_HEADER_SIZE = 2 * sizeof(uint64_t);
+
+    static constexpr uint64_t DATA_MAGIC = 0x4853544B4C5A3431ULL; // "HSTKLZ41"
+    static constexpr size_t DATA_HEADER_SIZE = 2 * sizeof(uint64_t);
+    static constexpr size_t BLOCK_HEADER_SIZE = 2 * sizeof(uint32_t);
+    static constexpr uint32_t MAX_COMPRESSION_BLOCK = 64 * 1024;
+    static constexpr uint64_t DICT_DATA_MAGIC = 0x4853544B5A443031ULL; // "HSTKZD01"
+
+    bool is_compressed() const { return compressed; }
 
 private:
     std::string index_file;
     std::string data_file;
+    ISAMOptions options;
 
     // File descriptors
     std::ofstream index_out;
     std::ofstream data_out;
 
-    std::ifstream index_in;
-    std::ifstream data_in;
+    // Read side, pread in stream mode and the mapping in mmap mode
+    RandomAccessFile data_in;
+    MappedFile data_map;
+
+    // Size of the data file, new records are appended here
+    uint64_t data_end = 0;
 
-    // Average C++ syntax moment
-    std::vector<std::pair<uint64_t, std::string > > to_write;
+    // Identity of the data file in options.block_cache
+    uint64_t data_file_id = 0;
 
-    // The index will usually be a few megabytes and thus it is viable to always keep it in memory
-    int index_ptr = 0;
+    // Compressed data file, records are buffered in pending_block until a block is full or the batch is committed
+    bool compressed = false;
+    uint32_t block_size = 0;
+    std::string pending_block;
+
+    // Dictionary compressed data file, the dictionary is null if it could not be loaded
+    bool dictionary_compressed = false;
+    std::shared_ptr<const RecordDictionary> dictionary;
+    std::string packed_record;
+
+    // The index will usually be a few megabytes and thus it is viable to always keep it in memory,
+    // for larger ones sparse_index_interval keeps only the top level resident
     bool index_loaded = false;
-    std::vector<std::pair<uint64_t, uint64_t> > loaded_indexes;
+    KeyIndex loaded_indexes;
+    SparseKeyIndex sparse_index;
+    bool sparse = false;
+
+    // Checked before every key lookup, empty when the store has no current filter
+    BloomFilterSet filters;
+
+    // Number of segments in the index file, a legacy file has none
+    int segment_count = 0;
+    bool legacy_index = false;
 
     void load_index_file();
+
+    void load_full_index();
+
+    // Index lookups that work for both the full and the sparse index
+    std::optional<uint64_t> find_offset(uint64_t key) const;
+    size_t lower_bound_position(uint64_t key) const;
+
+    void parse_index(const char* data, size_t size, std::vector<std::pair<uint64_t, uint64_t> >& entries);
+
+    void migrate_legacy_index();
+
+    // Finishes or cleans up after a compaction that did not complete
+    static void recover_compaction(const std::string& index_file, const std::string& data_file);
+
+    static void write_segment(std::ofstream& out, const std::vector<std::pair<uint64_t, uint64_t> >& entries);
+
+    // Appends a length-prefixed record to the data file and returns its offset
+    uint64_t append_record(std::string_view data);
+
+    // Appends a sorted, duplicate free batch of index entries as a new segment
+    void commit_segment(const std::vector<std::pair<uint64_t, uint64_t> >& new_indexes);
+
+    // Gets the files ready for a new segment: pending records written, no stale sparse top level, no legacy
+    // index. With merge_in_memory a sparse index is replaced by the full one
+    void begin_segment(bool merge_in_memory);
+
+    // Lets the read side see records appended since the data file was opened or mapped
+    void reopen_data();
+
+    // Adds the filter for a committed segment, or rebuilds the filter over all keys
+    void update_filters(const std::vector<std::pair<uint64_t, uint64_t> >& new_indexes);
+
+    // 0 if the store keeps no Bloom filter
+    uint32_t filter_bits_per_key() const;
+
+    // Saves a filter built for the newest segment (incremental) or for every key
+    void store_filter(BloomFilter filter, bool incremental);
+
+    // Reads the length-prefixed record at the given data file offset
+    std::optional<std::string_view> read_record(uint64_t offset, std::string& scratch) const;
+
+    // read_record() without undoing the dictionary compression
+    std::optional<std::string_view> read_raw_record(uint64_t offset, std::string& scratch) const;
+
+    // Decompresses a record of a dictionary compressed store, other records pass through unchanged
+    std::optional<std::string> decode_record(std::string raw) const;
+
+    // Detects the data file format, a new data file gets the compressed header if options ask for it
+    void init_data_format();
+
+    // Compresses pending_block and appends it to the data file
+    void flush_block();
+
+    // Decompressed block at a data file offset, from the cache when possible
+    BlockCache::block_t read_block(uint64_t block_offset) const;
+
+    // Record at offset_in_block of a decompressed block
+    static std::optional<std::string_view> record_in_block(const std::string& block, uint64_t offset_in_block);
 };
 
 
@@ -0,0 +1,139 @@
+#ifndef KEY_INDEX_HPP
+#define KEY_INDEX_HPP
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "block_cache.hpp"
+#include "mapped_file.hpp"
+#include "random_access_file.hpp"
+
+
+// In-memory key -> offset table of an ISAM store
+// Keys and offsets live in separate arrays so a search only pulls keys into cache.
+// The layout picks the search structure that is built at load time:
+//   BINARY        std::lower_bound over the sorted key array, no extra memory
+//   EYTZINGER     keys copied into BFS (heap) order, the top of the tree stays hot in cache
+//                 and the next levels can be prefetched, costs 20 extra bytes per key
+//   INTERPOLATION guesses the position from the key value, works well on dense keys
+//                 (word ids, consecutive post ids), falls back to binary search on skewed ranges
+class KeyIndex {
+public:
+    enum class Layout : uint8_t {
+        BINARY,
+        EYTZINGER,
+        INTERPOLATION,
+    };
+
+    explicit KeyIndex(Layout layout = Layout::BINARY) : layout(layout) {}
+
+    // Entries must be sorted by key and free of duplicates
+    void assign(const std::vector<std::pair<uint64_t, uint64_t> >& entries);
+
+    void clear();
+
+    // Copies the table back out as sorted (key, offset) pairs
+    std::vector<std::pair<uint64_t, uint64_t> > entries() const;
+
+    size_t size() const { return keys.size(); }
+
+    bool empty() const { return keys.empty(); }
+
+    uint64_t key_at(size_t position) const { return keys[position]; }
+
+    uint64_t offset_at(size_t position) const { return offsets[position]; }
+
+    // Position of the first key that is not less than key, size() if there is none
+    size_t lower_bound(uint64_t key) const;
+
+    // Data offset stored for the key, may find nothing
+    std::optional<uint64_t> find(uint64_t key) const;
+
+    Layout get_layout() const { return layout; }
+
+    // Rebuilds the search structure for the new layout
+    void set_layout(Layout new_layout);
+
+private:
+    Layout layout;
+
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> offsets;
+
+    // EYTZINGER only: 1-based BFS order, slot 0 is unused. rank maps a slot back to its sorted position,
+    // offsets are duplicated in slot order so a hit needs no second random access
+    std::vector<uint64_t> eytzinger_keys;
+    std::vector<uint64_t> eytzinger_offsets;
+    std::vector<uint32_t> eytzinger_rank;
+
+    void build_eytzinger();
+
+    // Slot of the first key that is not less than key, 0 if there is none
+    size_t eytzinger_slot(uint64_t key) const;
+
+    size_t interpolation_lower_bound(uint64_t key) const;
+};
+
+
+// Two-level index over an index file that holds exactly one sorted segment
+// Only the first key of every leaf page (interval entries) is kept in memory, leaf pages are read
+// from the index file when a lookup lands on them: from the mapping in mmap mode (the OS page cache
+// keeps hot pages), otherwise with a pread whose page is then kept in the BlockCache of the store,
+// keyed by (index file id, page offset). Without a cache every lookup reads its page again
+// The top level is persisted next to the index as <index>.top so opening does not touch the leaves
+class SparseKeyIndex {
+public:
+    // Returns false if the file is not a single segment, the caller should load the full index instead
+    // Pages read through pread go through cache when it is given
+    bool open(const std::string& index_file, uint32_t interval, bool use_mmap,
+              std::shared_ptr<BlockCache> cache = nullptr);
+
+    void close();
+
+    size_t size() const { return count; }
+
+    // Position of the first key that is not less than key, size() if there is none
+    size_t lower_bound(uint64_t key) const;
+
+    // Data offset stored for the key, may find nothing
+    std::optional<uint64_t> find(uint64_t key) const;
+
+    // Replaces out with up to max_entries entries starting at position, used by cursors
+    void read_entries(size_t position, size_t max_entries, std::vector<std::pair<uint64_t, uint64_t> >& out) const;
+
+    static std::string top_file_path(const std::string& index_file) { return index_file + ".top"; }
+
+    static constexpr uint64_t TOP_MAGIC = 0x4853544B544F5031ULL; // "HSTKTOP1"
+
+private:
+    uint32_t interval = 0;
+    uint64_t count = 0;
+    bool use_mmap = false;
+
+    // First key of every leaf page
+    std::vector<uint64_t> page_keys;
+
+    MappedFile index_map;
+    RandomAccessFile index_in;
+
+    std::shared_ptr<BlockCache> cache;
+    uint64_t index_file_id = 0;
+
+    // Pointer to the raw entries of a page, points into the mapping, into buffer or into block, which
+    // holds a cached page until the caller is done with it
+    const char* page_data(size_t page, std::string& buffer, BlockCache::block_t& block) const;
+
+    size_t page_length(size_t page) const;
+
+    bool load_top_file(const std::string& top_file, uint64_t index_size);
+
+    void build_top_level();
+
+    void save_top_file(const std::string& top_file, uint64_t index_size) const;
+};
+
+
+#endif //KEY_INDEX_HPP
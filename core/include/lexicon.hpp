@@ -3,30 +3,52 @@
 
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#include "mapped_file.hpp"
+
+// Word <-> id mapping, ids start at 1
+// Built in memory with add_word() and saved as text (one word per line, line n holds id n) or in the
+// binary format below. A binary lexicon is used straight from a memory mapping: open() only checks the
+// header, lookups decode the few bytes they need and nothing is allocated per word.
+// Binary layout: [MAGIC][word count N][block count B][string bytes]
+//                [block offset (u64)]*B [id of rank (u32)]*N [rank of id (u32)]*(N + 1) [strings]
+// with every array starting 8-byte aligned. Words are sorted bytewise and front coded in blocks of
+// BLOCK_SIZE: each word is [shared prefix length][suffix length][suffix] (LEB128 lengths), the first
+// word of a block shares nothing, so a binary search over block heads finds the block of a word
 class Lexicon {
 public:
-    // Adds a word and returns its id
-    uint64_t add_word(std::string word);
+    static constexpr uint64_t MAGIC = 0x4853544B4C455831;  // "HSTKLEX1"
+    static constexpr size_t HEADER_SIZE = 32;
+    static constexpr size_t BLOCK_SIZE = 16;
+
+    // Where the indexer keeps the binary lexicon
+    static std::string file_path(const std::string& directory) { return directory + "/lexicon.bin"; }
+
+    // Adds a word and returns its id, 0 for an empty word
+    // An opened binary lexicon is read only, it returns the id of known words and 0 for new ones
+    uint64_t add_word(std::string_view word);
 
     // Batch word addition, input is expected to be normalized
     void add_words(std::vector<std::string> words);
 
     // Returns empty string if no word exists
-    std::string get_word(int word_id);
+    std::string get_word(int word_id) const;
 
     // Returns 0 if no id exists
-    uint64_t get_word_id(std::string word);
+    uint64_t get_word_id(std::string_view word) const;
 
-    uint64_t size();
+    // Number of words plus one, id 0 is reserved
+    uint64_t size() const;
 
-    // Converts a given chunk of text into normalized tokens
-    static std::vector<std::string> tokenize_text(std::string text, char delim = ' ');
+    // Converts a given chunk of text into normalized tokens, split at any whitespace
+    // Hot loops iterate with a Tokenizer instead and skip the copies
+    static std::vector<std::string> tokenize_text(std::string_view text);
 
-    // Normalizes the given token by converting to lowercase, trimming and removing certain symbols
-    static std::string normalize_token(std::string token);
+    // Normalizes the given token by case folding (Unicode aware), trimming and removing certain symbols
+    static std::string normalize_token(std::string_view token);
 
     // Returns true on success, false on failure
     bool save(std::string file_path);
@@ -34,6 +56,14 @@ public:
     // Returns true on success, false on failure
     bool load(std::string file_path);
 
+    // Writes the words added so far in the binary format, returns true on success, false on failure
+    bool save_binary(const std::string& path) const;
+
+    // Maps a binary lexicon, the words added before are dropped. Returns true on success, false on failure
+    bool open(const std::string& path);
+
+    bool is_mapped() const { return file.is_open(); }
+
     Lexicon();
 
 
@@ -43,9 +73,23 @@ private:
 
     uint64_t next_id = 1; // 0 is for not found
 
-
-    // Removes leading and lagging spaces + any other specified characters
-    static std::string trim(const std::string & source, std::string remove_left = "", std::string remove_right = "");
+    // The map is keyed by std::string, lookups of views go through a reused per-thread copy
+    static const std::string& lookup_key(std::string_view word);
+
+    // Binary lexicon, valid while the file is open
+    MappedFile file;
+    uint64_t mapped_words = 0;
+    uint64_t block_count = 0;
+    const uint64_t* block_offsets = nullptr;
+    const uint32_t* rank_ids = nullptr;
+    const uint32_t* id_ranks = nullptr;
+    const char* strings = nullptr;
+    const char* strings_end = nullptr;
+
+    uint64_t mapped_word_id(std::string_view word) const;
+    std::string mapped_word(uint64_t word_id) const;
+    // First word of a block, points into the mapping
+    std::string_view block_head(uint64_t block) const;
 };
 
 #endif //LEXICON_H
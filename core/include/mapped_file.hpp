@@ -0,0 +1,39 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+#include <cstddef>
+#include <string>
+
+
+// Read-only memory mapping of a whole file
+// The mapping is private to this object and released on close() or destruction
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    // Returns true on success, false on failure. An empty file maps successfully with size() == 0
+    bool open(const std::string& path);
+
+    void close();
+
+    bool is_open() const { return opened; }
+
+    const char* data() const { return base; }
+
+    size_t size() const { return length; }
+
+private:
+    const char* base = nullptr;
+    size_t length = 0;
+    bool opened = false;
+};
+
+
+#endif //MAPPED_FILE_HPP
@@ -1,7 +1,10 @@
 #ifndef POST_HPP
 #define POST_HPP
+#include <optional>
+#include <string_view>
 #include <vector>
 #include "nlohmann/json.hpp"
+#include "binary_record.hpp"
 #include "compound_key.hpp"
 
 class Post {
@@ -45,6 +48,9 @@ public:
              score(0), view_count(0), answer_count(0), comment_count(0) {
     }
 
+    // Compact binary form used by the data index, read back through PostView
+    static std::string to_binary(const Post &post);
+
     // Serialization functions (because C++ doesn't have reflection!)
     static nlohmann::json to_json(const Post &post) {
         return nlohmann::json{
@@ -119,4 +125,185 @@ public:
 };
 
 
+// Read-only view of a binary post record, fields are read in place without parsing or allocating
+// The viewed bytes must stay alive (and unchanged) while the view is used
+class PostView {
+public:
+    // Fixed part of the record, see BinaryRecord for the overall layout
+    static constexpr size_t FLAGS_OFFSET = 2;
+    static constexpr size_t SITE_ID_OFFSET = 4;
+    static constexpr size_t POST_ID_OFFSET = 8;
+    static constexpr size_t POST_TYPE_ID_OFFSET = 12;
+    static constexpr size_t PARENT_ID_OFFSET = 16;
+    static constexpr size_t ACCEPTED_ANSWER_ID_OFFSET = 20;
+    static constexpr size_t OWNER_USER_ID_OFFSET = 24;
+    static constexpr size_t LAST_EDITOR_USER_ID_OFFSET = 28;
+    static constexpr size_t SCORE_OFFSET = 32;
+    static constexpr size_t VIEW_COUNT_OFFSET = 36;
+    static constexpr size_t ANSWER_COUNT_OFFSET = 40;
+    static constexpr size_t COMMENT_COUNT_OFFSET = 44;
+    static constexpr size_t TAG_COUNT_OFFSET = 48;
+    static constexpr size_t STRING_TABLE_OFFSET = 52;
+
+    // Bits of the flags byte, set when the optional field holds a value
+    static constexpr uint8_t HAS_PARENT_ID = 1;
+    static constexpr uint8_t HAS_ACCEPTED_ANSWER_ID = 2;
+    static constexpr uint8_t HAS_OWNER_USER_ID = 4;
+    static constexpr uint8_t HAS_LAST_EDITOR_USER_ID = 8;
+
+    // Order of the strings, the tags follow the last one
+    enum StringField : uint8_t {
+        TITLE,
+        BODY,
+        CLEANED_BODY,
+        CREATION_DATE,
+        LAST_EDIT_DATE,
+        LAST_ACTIVITY_DATE,
+        CONTENT_LICENSE,
+        STRING_FIELD_COUNT
+    };
+
+    // Empty if the bytes are not a complete binary post
+    static std::optional<PostView> from_binary(std::string_view record) {
+        if (!BinaryRecord::has_magic(record, BinaryRecord::POST_MAGIC) || record.size() < STRING_TABLE_OFFSET) {
+            return std::nullopt;
+        }
+        PostView view(record);
+        if (!BinaryRecord::check_strings(record, STRING_TABLE_OFFSET, view.string_count())) {
+            return std::nullopt;
+        }
+        return view;
+    }
+
+    // Accepts binary and JSON records (stores written before the binary format), JSON is converted into scratch
+    static std::optional<PostView> from_record(std::string_view record, std::string& scratch) {
+        if (BinaryRecord::has_magic(record, BinaryRecord::POST_MAGIC)) {
+            return from_binary(record);
+        }
+
+        nlohmann::json j = nlohmann::json::parse(record, nullptr, false);
+        if (j.is_discarded()) return std::nullopt;
+        try {
+            scratch = Post::to_binary(Post::from_json(j));
+        } catch (const nlohmann::json::exception&) {
+            return std::nullopt;
+        }
+        return from_binary(scratch);
+    }
+
+    SiteID site_id() const { return static_cast<SiteID>(BinaryRecord::get<uint16_t>(record, SITE_ID_OFFSET)); }
+    uint32_t post_id() const { return BinaryRecord::get<uint32_t>(record, POST_ID_OFFSET); }
+    uint32_t post_type_id() const { return BinaryRecord::get<uint32_t>(record, POST_TYPE_ID_OFFSET); }
+
+    std::optional<uint32_t> parent_id() const { return optional_field(HAS_PARENT_ID, PARENT_ID_OFFSET); }
+    std::optional<uint32_t> accepted_answer_id() const {
+        return optional_field(HAS_ACCEPTED_ANSWER_ID, ACCEPTED_ANSWER_ID_OFFSET);
+    }
+    std::optional<uint32_t> owner_user_id() const { return optional_field(HAS_OWNER_USER_ID, OWNER_USER_ID_OFFSET); }
+    std::optional<uint32_t> last_editor_user_id() const {
+        return optional_field(HAS_LAST_EDITOR_USER_ID, LAST_EDITOR_USER_ID_OFFSET);
+    }
+
+    int32_t score() const { return BinaryRecord::get<int32_t>(record, SCORE_OFFSET); }
+    uint32_t view_count() const { return BinaryRecord::get<uint32_t>(record, VIEW_COUNT_OFFSET); }
+    uint32_t answer_count() const { return BinaryRecord::get<uint32_t>(record, ANSWER_COUNT_OFFSET); }
+    uint32_t comment_count() const { return BinaryRecord::get<uint32_t>(record, COMMENT_COUNT_OFFSET); }
+
+    std::string_view title() const { return string_field(TITLE); }
+    std::string_view body() const { return string_field(BODY); }
+    std::string_view cleaned_body() const { return string_field(CLEANED_BODY); }
+    std::string_view creation_date() const { return string_field(CREATION_DATE); }
+    std::string_view last_edit_date() const { return string_field(LAST_EDIT_DATE); }
+    std::string_view last_activity_date() const { return string_field(LAST_ACTIVITY_DATE); }
+    std::string_view content_license() const { return string_field(CONTENT_LICENSE); }
+
+    uint32_t tag_count() const { return BinaryRecord::get<uint32_t>(record, TAG_COUNT_OFFSET); }
+    std::string_view tag(size_t i) const { return string_field(STRING_FIELD_COUNT + i); }
+
+    // Copies everything out into an owning Post
+    Post to_post() const {
+        Post post;
+        post.site_id = site_id();
+        post.post_id = post_id();
+        post.post_type_id = post_type_id();
+        post.title = title();
+        post.body = body();
+        for (uint32_t i = 0; i < tag_count(); i++) {
+            post.tags.emplace_back(tag(i));
+        }
+        post.cleaned_body = cleaned_body();
+        post.parent_id = parent_id();
+        post.accepted_answer_id = accepted_answer_id();
+        post.owner_user_id = owner_user_id();
+        post.last_editor_user_id = last_editor_user_id();
+        post.score = score();
+        post.view_count = view_count();
+        post.answer_count = answer_count();
+        post.comment_count = comment_count();
+        post.creation_date = creation_date();
+        post.last_edit_date = last_edit_date();
+        post.last_activity_date = last_activity_date();
+        post.content_license = content_license();
+        return post;
+    }
+
+private:
+    explicit PostView(std::string_view record) : record(record) {}
+
+    std::string_view record;
+
+    size_t string_count() const { return STRING_FIELD_COUNT + tag_count(); }
+
+    std::string_view string_field(size_t index) const {
+        return BinaryRecord::string_at(record, STRING_TABLE_OFFSET, string_count(), index);
+    }
+
+    std::optional<uint32_t> optional_field(uint8_t bit, size_t offset) const {
+        if ((static_cast<uint8_t>(record[FLAGS_OFFSET]) & bit) == 0) return std::nullopt;
+        return BinaryRecord::get<uint32_t>(record, offset);
+    }
+};
+
+
+inline std::string Post::to_binary(const Post &post) {
+    size_t string_count = PostView::STRING_FIELD_COUNT + post.tags.size();
+    std::string out(PostView::STRING_TABLE_OFFSET + string_count * sizeof(uint32_t), '\0');
+
+    uint8_t flags = (post.parent_id ? PostView::HAS_PARENT_ID : 0) |
+                    (post.accepted_answer_id ? PostView::HAS_ACCEPTED_ANSWER_ID : 0) |
+                    (post.owner_user_id ? PostView::HAS_OWNER_USER_ID : 0) |
+                    (post.last_editor_user_id ? PostView::HAS_LAST_EDITOR_USER_ID : 0);
+    out[0] = static_cast<char>(BinaryRecord::POST_MAGIC);
+    out[1] = static_cast<char>(BinaryRecord::VERSION);
+    out[PostView::FLAGS_OFFSET] = static_cast<char>(flags);
+
+    BinaryRecord::put<uint16_t>(out, PostView::SITE_ID_OFFSET, static_cast<uint16_t>(post.site_id));
+    BinaryRecord::put<uint32_t>(out, PostView::POST_ID_OFFSET, post.post_id);
+    BinaryRecord::put<uint32_t>(out, PostView::POST_TYPE_ID_OFFSET, post.post_type_id);
+    BinaryRecord::put<uint32_t>(out, PostView::PARENT_ID_OFFSET, post.parent_id.value_or(0));
+    BinaryRecord::put<uint32_t>(out, PostView::ACCEPTED_ANSWER_ID_OFFSET, post.accepted_answer_id.value_or(0));
+    BinaryRecord::put<uint32_t>(out, PostView::OWNER_USER_ID_OFFSET, post.owner_user_id.value_or(0));
+    BinaryRecord::put<uint32_t>(out, PostView::LAST_EDITOR_USER_ID_OFFSET, post.last_editor_user_id.value_or(0));
+    BinaryRecord::put<int32_t>(out, PostView::SCORE_OFFSET, post.score);
+    BinaryRecord::put<uint32_t>(out, PostView::VIEW_COUNT_OFFSET, post.view_count);
+    BinaryRecord::put<uint32_t>(out, PostView::ANSWER_COUNT_OFFSET, post.answer_count);
+    BinaryRecord::put<uint32_t>(out, PostView::COMMENT_COUNT_OFFSET, post.comment_count);
+    BinaryRecord::put<uint32_t>(out, PostView::TAG_COUNT_OFFSET, static_cast<uint32_t>(post.tags.size()));
+
+    out.reserve(out.size() + post.title.size() + post.body.size() + post.cleaned_body.size() + 128);
+    const std::string* strings[PostView::STRING_FIELD_COUNT] = {
+        &post.title, &post.body, &post.cleaned_body, &post.creation_date,
+        &post.last_edit_date, &post.last_activity_date, &post.content_license
+    };
+    size_t index = 0;
+    for (const std::string* s : strings) {
+        BinaryRecord::append_string(out, PostView::STRING_TABLE_OFFSET, index++, *s);
+    }
+    for (const auto& tag : post.tags) {
+        BinaryRecord::append_string(out, PostView::STRING_TABLE_OFFSET, index++, tag);
+    }
+    return out;
+}
+
+
 #endif //POST_HPP
@@ -0,0 +1,58 @@
+#ifndef POST_STORE_HPP
+#define POST_STORE_HPP
+#include <cstdint>
+#include <initializer_list>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "isam_storage.hpp"
+#include "post.hpp"
+
+
+// Field projection over the data index: reads only the parts of a post that are asked for
+// On plain stores holding binary posts only the fixed part, the offset table and the byte ranges of the
+// requested strings come off disk. Compressed stores and JSON records are decoded whole
+class PostStore {
+public:
+    // Strings that can be requested, the numeric fields always come along
+    // The first values follow PostView::StringField
+    enum Field : uint8_t {
+        TITLE,
+        BODY,
+        CLEANED_BODY,
+        CREATION_DATE,
+        LAST_EDIT_DATE,
+        LAST_ACTIVITY_DATE,
+        CONTENT_LICENSE,
+        TAGS
+    };
+
+    // Bytes read up front, enough for the fixed part, the offset table and a typical title
+    static constexpr size_t HEAD_READ_SIZE = 512;
+
+    // Requested strings closer than this are fetched with one read instead of two
+    static constexpr size_t MERGE_GAP = 4 * 1024;
+
+    explicit PostStore(const ISAMStorage& data_index) : data_index(data_index) {}
+
+    // View of the post under key, strings that were not requested may be empty
+    // The view points into scratch. Empty if the key is missing or the record is damaged
+    std::optional<PostView> read_fields(uint64_t key, std::initializer_list<Field> fields,
+                                        std::string& scratch) const;
+
+    // Batched read_fields() for a result page, results come back in the order of the keys
+    // The records come from one ISAMStorage::read_many(), which sorts the fetches by offset and merges
+    // reads of records that lie close together. Whole records come off disk, the strings that were not
+    // requested are dropped from the copies. Result i points into scratch[i]
+    std::vector<std::optional<PostView> > read_fields_many(const std::vector<uint64_t>& keys,
+                                                           std::initializer_list<Field> fields,
+                                                           std::vector<std::string>& scratch,
+                                                           int threads = 1) const;
+
+private:
+    const ISAMStorage& data_index;
+};
+
+
+#endif //POST_STORE_HPP
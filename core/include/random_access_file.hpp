@@ -0,0 +1,44 @@
+#ifndef RANDOM_ACCESS_FILE_HPP
+#define RANDOM_ACCESS_FILE_HPP
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+// Read-only file handle for positional reads (pread)
+// There is no shared file position, so any number of threads can call read_at() at once
+class RandomAccessFile {
+public:
+    RandomAccessFile() = default;
+
+    ~RandomAccessFile();
+
+    RandomAccessFile(const RandomAccessFile&) = delete;
+    RandomAccessFile& operator=(const RandomAccessFile&) = delete;
+
+    RandomAccessFile(RandomAccessFile&& other) noexcept;
+    RandomAccessFile& operator=(RandomAccessFile&& other) noexcept;
+
+    // Returns true on success, false on failure
+    bool open(const std::string& path);
+
+    void close();
+
+    bool is_open() const;
+
+    // Reads exactly len bytes starting at offset, returns false on error or a short read
+    bool read_at(uint64_t offset, char* buffer, size_t len) const;
+
+    // Flushes the file's contents to stable storage (fsync), returns false on failure
+    static bool sync_file(const std::string& path);
+
+private:
+#ifdef _WIN32
+    void* handle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+
+#endif //RANDOM_ACCESS_FILE_HPP
@@ -0,0 +1,57 @@
+#ifndef RECORD_DICTIONARY_HPP
+#define RECORD_DICTIONARY_HPP
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+
+// Shared zstd dictionary for stores of many small, similar records (posts as JSON)
+// Field names, licenses and date formats live in the dictionary once instead of in every record,
+// each record is still compressed on its own so a read decompresses just that record.
+// Thread-safe, every thread compresses and decompresses with its own zstd context
+class RecordDictionary {
+public:
+    ~RecordDictionary();
+
+    RecordDictionary(const RecordDictionary&) = delete;
+    RecordDictionary& operator=(const RecordDictionary&) = delete;
+
+    // Trains a dictionary of at most max_size bytes on sample records, nullptr if zstd could not build one
+    // (too few or too uniform samples). zstd wants roughly 100 times the dictionary size in samples
+    static std::shared_ptr<const RecordDictionary> train(const std::vector<std::string>& samples,
+                                                         size_t max_size = 64 * 1024, int level = 3);
+
+    // Reads a dictionary written by save(), nullptr on failure
+    static std::shared_ptr<const RecordDictionary> load(const std::string& path, int level = 3);
+
+    bool save(const std::string& path) const;
+
+    // Id zstd stores in the dictionary and in every frame compressed with it
+    uint32_t id() const { return dict_id; }
+
+    size_t size() const { return bytes.size(); }
+
+    // Replace out with the compressed or decompressed record, false on failure
+    bool compress(std::string_view record, std::string& out) const;
+    bool decompress(std::string_view packed, std::string& out) const;
+
+    // Dictionaries are kept next to the data file they belong to
+    static std::string file_path(const std::string& data_file) { return data_file + ".dict"; }
+
+private:
+    RecordDictionary(std::string bytes, int level);
+
+    std::string bytes;
+    uint32_t dict_id = 0;
+    ZSTD_CDict_s* cdict = nullptr;
+    ZSTD_DDict_s* ddict = nullptr;
+};
+
+
+#endif //RECORD_DICTIONARY_HPP
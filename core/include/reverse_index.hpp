@@ -7,12 +7,13 @@
 #include <set>
 #include <memory>
 
+#include "doc_id_map.hpp"
 #include "isam_storage.hpp"
 #include "lexicon.hpp"
 
 //  Posting
 struct Posting {
-    uint32_t doc_id;
+    uint32_t doc_id; // Dense doc number from the DocIdMap saved with the barrels, the post id in older barrels
 };
 
 // Trie Node for Autocomplete
@@ -67,11 +68,20 @@ public:
     explicit ReverseIndex(int num_barrels = 1);
     ~ReverseIndex() = default;
 
-    bool build(ISAMStorage& forward_index, const Lexicon& lexicon);
-    void save_barrels(const std::string& directory);
-    static postings_list_t search_barrel(const std::string& directory, int barrel_id, int word_id);
+    bool build(const ISAMStorage& forward_index, const Lexicon& lexicon);
+    // Adds the (word id, hit mask) list of one document, used by build() and by pipelined builds that
+    // produce forward records on the fly. Keys have to come in increasing order, false for one that does not
+    bool add_document(uint64_t key, const std::vector<std::pair<uint32_t, uint8_t>>& words);
+    void save_barrels(const std::string& directory,
+                      ISAMOptions::Compression compression = ISAMOptions::Compression::NONE);
+    // A long-running searcher passes one cache for all queries so hot posting lists stay in memory
+    static postings_list_t search_barrel(const std::string& directory, int barrel_id, int word_id,
+                                         std::shared_ptr<BlockCache> cache = nullptr);
     size_t total_terms() const;
 
+    // Doc numbers handed out by the last build(), saved next to the barrels
+    const DocIdMap& doc_ids() const { return doc_ids_; }
+
     // Autocomplete
     void build_autocomplete_trie();
     std::vector<std::string> autocomplete(const std::string& prefix, int limit = 10) const;
@@ -79,6 +89,7 @@ public:
 private:
     int num_barrels_;
     std::vector<index_map_t> index_shards_;
+    DocIdMap doc_ids_;
     static const postings_list_t EMPTY_POSTINGS_LIST;
 
     // Autocomplete members
@@ -0,0 +1,106 @@
+#ifndef TOKENIZER_HPP
+#define TOKENIZER_HPP
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// Splits text into normalized tokens without copying it
+// Tokens are the runs between whitespace (space, \t, \n, \v, \f, \r). Each one is normalized by trimming
+// less meaningful symbols off both ends and case folding it, tokens left empty by that are skipped.
+// All-ASCII tokens are lowercased in bulk, only tokens with multibyte UTF-8 sequences go through the
+// Unicode case folding in CaseFolding
+// A token points into the text when normalizing did not change its characters, otherwise into a scratch
+// buffer owned by the thread, so it is only valid until the next call to next() or normalize() on that thread
+// Text is classified 64 bytes at a time into whitespace, uppercase and multibyte bit masks, token boundaries are then
+// found with bit scans. Classification and lowercasing run on SSE2 or AVX2 kernels, 16 or 32 bytes per
+// instruction, the fastest backend the CPU supports is picked on first use
+class Tokenizer {
+public:
+    enum class Backend {
+        SCALAR,
+        SSE2,
+        AVX2
+    };
+
+    explicit Tokenizer(std::string_view text);
+
+    // Next token, empty at the end of the text
+    std::optional<std::string_view> next();
+
+    // Normalized form of a single token, may be empty
+    static std::string_view normalize(std::string_view token);
+
+    static bool is_space(char c) {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    // Symbols trimmed off the ends of a token
+    static bool is_trimmed(char c);
+
+    static Backend backend();
+    // Switches all tokenizers created afterwards, for benchmarks and tests. False if the build or CPU
+    // does not support the backend
+    static bool set_backend(Backend backend);
+    static const char* backend_name(Backend backend);
+
+    // Function table of a backend, defined next to the kernels
+    struct Kernels;
+
+private:
+    std::string_view text;
+    size_t pos = 0;
+    const Kernels* kernels;
+
+    // Masks of the 64 byte block starting at block_start, bit i stands for byte block_start + i
+    size_t block_start = 0;
+    uint64_t space_bits = 0;
+    uint64_t upper_bits = 0;
+    uint64_t multibyte_bits = 0;
+    bool block_loaded = false;
+
+    void load_block(size_t start);
+
+    static const Kernels* active_kernels();
+    static std::string_view normalize(std::string_view token, bool has_upper, bool has_multibyte,
+                                      const Kernels* kernels);
+};
+
+
+// Tokens copied back to back into one buffer, so the tokens of a post can be kept or handed to another
+// thread without allocating a string for each of them. clear() keeps the memory for the next post
+class TokenList {
+public:
+    void clear() {
+        arena.clear();
+        ends.clear();
+    }
+
+    void push_back(std::string_view token) {
+        arena.append(token);
+        ends.push_back(static_cast<uint32_t>(arena.size()));
+    }
+
+    size_t size() const { return ends.size(); }
+
+    std::string_view operator[](size_t i) const {
+        uint32_t begin = i == 0 ? 0 : ends[i - 1];
+        return std::string_view(arena).substr(begin, ends[i] - begin);
+    }
+
+    // Every token of text
+    void tokenize(std::string_view text) {
+        Tokenizer tokenizer(text);
+        while (auto token = tokenizer.next()) push_back(*token);
+    }
+
+private:
+    std::string arena;
+    std::vector<uint32_t> ends;
+};
+
+
+#endif //TOKENIZER_HPP
@@ -0,0 +1,72 @@
+#ifndef UTF8_HPP
+#define UTF8_HPP
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+// Encoding and decoding of single UTF-8 sequences
+class Utf8 {
+public:
+    static void append(uint32_t code_point, std::string& out) {
+        if (code_point < 0x80) {
+            out += static_cast<char>(code_point);
+        } else if (code_point < 0x800) {
+            out += static_cast<char>(0xC0 | (code_point >> 6));
+            out += static_cast<char>(0x80 | (code_point & 0x3F));
+        } else if (code_point < 0x10000) {
+            out += static_cast<char>(0xE0 | (code_point >> 12));
+            out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code_point & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (code_point >> 18));
+            out += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code_point & 0x3F));
+        }
+    }
+
+    // Decodes the sequence starting at data[0] and returns its length. 0 if it is not valid UTF-8: a stray
+    // continuation byte, a cut off sequence, an overlong encoding, a surrogate or a value past U+10FFFF
+    static size_t decode(const char* data, size_t size, uint32_t& code_point) {
+        if (size == 0) return 0;
+        uint8_t lead = static_cast<uint8_t>(data[0]);
+        if (lead < 0x80) {
+            code_point = lead;
+            return 1;
+        }
+
+        size_t length;
+        uint32_t value;
+        uint32_t min_value;
+        if ((lead & 0xE0) == 0xC0) {
+            length = 2;
+            value = lead & 0x1F;
+            min_value = 0x80;
+        } else if ((lead & 0xF0) == 0xE0) {
+            length = 3;
+            value = lead & 0x0F;
+            min_value = 0x800;
+        } else if ((lead & 0xF8) == 0xF0) {
+            length = 4;
+            value = lead & 0x07;
+            min_value = 0x10000;
+        } else {
+            return 0;
+        }
+        if (size < length) return 0;
+
+        for (size_t i = 1; i < length; i++) {
+            uint8_t next = static_cast<uint8_t>(data[i]);
+            if ((next & 0xC0) != 0x80) return 0;
+            value = (value << 6) | (next & 0x3F);
+        }
+        if (value < min_value || value > 0x10FFFF || (value >= 0xD800 && value <= 0xDFFF)) return 0;
+
+        code_point = value;
+        return length;
+    }
+};
+
+
+#endif //UTF8_HPP
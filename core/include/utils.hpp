@@ -1,8 +1,10 @@
 #ifndef UTILS_H
 #define UTILS_H
 #include <cstdint>
+#include <functional>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "compound_key.hpp"
@@ -10,23 +12,43 @@
 #include "post.hpp"
 #include "comment.hpp"
 #include "lexicon.hpp"
+#include "pugixml.hpp"
 
 
 // A class with helpful static functions, and functions to generate the needed files
 class Utils {
 public:
-    // Write comments and posts into data index as JSON
-    static void generate_data_index(ISAMStorage& data_index, const std::string& post_file);
+    // Write comments and posts into data index as binary records, read them back with PostView
+    // With train_dictionary a zstd dictionary is trained on a sample of the posts first and every record is
+    // compressed against it, the data index must be empty for that. threads > 1 parses Posts.xml in parallel
+    static void generate_data_index(ISAMStorage& data_index, const std::string& post_file,
+                                    bool train_dictionary = false, int threads = 1);
 
     // Create the lexicon from the data index
-    static Lexicon generate_lexicon(ISAMStorage& data_index);
+    static Lexicon generate_lexicon(const ISAMStorage& data_index);
 
 
     static std::vector<std::string> parse_tags(const std::string& tags_str);
 
+    // Text of an HTML fragment in one pass: tags are dropped, character references decoded and runs of
+    // whitespace turned into single spaces, with none at the ends
     static std::string extract_text_from_html(const std::string& html);
+    // Same, but writes into text so a caller cleaning many bodies can reuse its buffer
+    static void extract_text_from_html(std::string_view html, std::string& text);
 
 
+    // Fields of one <row> of Posts.xml. Without clean_body the cleaned body is left empty, for callers that
+    // run extract_text_from_html() elsewhere
+    static Post post_from_row(const pugi::xml_node& row, SiteID site_id, bool clean_body = true);
+
+    // Streams Posts.xml and hands every post to on_post as soon as its row is parsed, memory use does not
+    // grow with the file. Returns the number of posts handed out
+    // With threads > 1 chunks of rows are parsed on that many workers, on_post still runs on the calling
+    // thread and sees the posts in file order
+    static size_t for_each_post(const std::string& xml_file_path, SiteID site_id,
+                                const std::function<void(Post&&)>& on_post, size_t limit = SIZE_MAX,
+                                int threads = 1);
+
     // Parse Posts.xml into Post objects with configurable limit
     static std::vector<Post> parse_posts_from_xml(const std::string& xml_file_path,
                                           SiteID site_id,
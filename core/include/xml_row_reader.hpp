@@ -0,0 +1,68 @@
+#ifndef XML_ROW_READER_HPP
+#define XML_ROW_READER_HPP
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "pugixml.hpp"
+
+
+// Streams the <row .../> elements of a Stack Exchange dump (Posts.xml, Comments.xml, ...)
+// The file is read through a fixed-size buffer and every row is parsed on its own as a small document,
+// so memory use depends on the longest row and not on the file. Everything outside the rows (declaration,
+// root element) is skipped. The buffer only grows when a single row does not fit into it
+class XmlRowReader {
+public:
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 4 * 1024 * 1024;
+
+    explicit XmlRowReader(size_t buffer_size = DEFAULT_BUFFER_SIZE) : buffer_size(buffer_size) {}
+
+    XmlRowReader(const XmlRowReader&) = delete;
+    XmlRowReader& operator=(const XmlRowReader&) = delete;
+
+    // Returns true on success, false on failure
+    bool open(const std::string& path);
+
+    // Reads rows from memory instead of a file, e.g. a chunk from next_chunk()
+    void open_buffer(std::string data);
+
+    // Next row, the node stays valid until the next call. Empty at the end of the file or on a read error
+    std::optional<pugi::xml_node> next();
+
+    // Unparsed text of the next whole rows, at least target_size bytes unless the file ends first.
+    // Lets rows be split off on one thread and parsed on others. Empty at the end of the file
+    std::optional<std::string> next_chunk(size_t target_size);
+
+    // Rows that could not be parsed and were skipped so far
+    uint64_t skipped_rows() const { return skipped; }
+
+private:
+    size_t buffer_size;
+    std::ifstream in;
+    bool opened = false;
+    bool at_eof = false;
+
+    // Unparsed input is buffer[begin, end)
+    std::string buffer;
+    size_t begin = 0;
+    size_t end = 0;
+
+    pugi::xml_document row_document;
+    uint64_t skipped = 0;
+
+    // Moves the unparsed bytes to the front and reads more behind them, false if nothing was added
+    bool refill();
+
+    // Bounds [start, stop) of the next row in the buffer, begin moves past it. Empty at the end of the file
+    std::optional<std::pair<size_t, size_t> > next_row_bounds();
+
+    // One past the '>' that closes the element starting at start, quoted attribute values are stepped over.
+    // Empty if the element runs past the buffered input
+    std::optional<size_t> element_end(size_t start) const;
+};
+
+
+#endif //XML_ROW_READER_HPP
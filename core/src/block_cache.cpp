@@ -0,0 +1,150 @@
+#include "block_cache.hpp"
+
+#include <functional>
+#include <system_error>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+BlockCache::BlockCache(size_t capacity_bytes)
+    : shard_capacity(capacity_bytes / SHARD_COUNT),
+      protected_capacity(capacity_bytes / SHARD_COUNT * 4 / 5),
+      shards(SHARD_COUNT) {
+}
+
+uint64_t BlockCache::hash_key(uint64_t file_id, uint64_t offset) {
+    // Mix both halves so neighbouring offsets spread across shards
+    uint64_t h = file_id ^ (offset * 0x9E3779B97F4A7C15ULL);
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+BlockCache::Shard& BlockCache::shard_for(uint64_t hash) {
+    return shards[hash % SHARD_COUNT];
+}
+
+BlockCache::block_t BlockCache::get(uint64_t file_id, uint64_t offset) {
+    uint64_t hash = hash_key(file_id, offset);
+    Shard& shard = shard_for(hash);
+    std::lock_guard<std::mutex> guard(shard.lock);
+
+    auto it = shard.entries.find(hash);
+    if (it == shard.entries.end() || it->second->file_id != file_id || it->second->offset != offset) {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    hits.fetch_add(1, std::memory_order_relaxed);
+
+    auto entry = it->second;
+    size_t bytes = entry->block->size();
+
+    if (entry->is_protected) {
+        shard.protected_.splice(shard.protected_.begin(), shard.protected_, entry);
+    } else {
+        // Second hit, the block has proven itself and moves to protected
+        entry->is_protected = true;
+        shard.probation_bytes -= bytes;
+        shard.protected_bytes += bytes;
+        shard.protected_.splice(shard.protected_.begin(), shard.probation, entry);
+
+        // Overflow of protected goes back to the front of probation, it gets one more chance there
+        while (shard.protected_bytes > protected_capacity && shard.protected_.size() > 1) {
+            auto demoted = std::prev(shard.protected_.end());
+            demoted->is_protected = false;
+            shard.protected_bytes -= demoted->block->size();
+            shard.probation_bytes += demoted->block->size();
+            shard.probation.splice(shard.probation.begin(), shard.protected_, demoted);
+        }
+    }
+
+    return entry->block;
+}
+
+void BlockCache::put(uint64_t file_id, uint64_t offset, block_t block) {
+    if (!block || block->size() > shard_capacity / 8) return;
+
+    uint64_t hash = hash_key(file_id, offset);
+    Shard& shard = shard_for(hash);
+    std::lock_guard<std::mutex> guard(shard.lock);
+
+    // Blocks never change once written, an existing entry (or a hash collision) is left alone
+    if (shard.entries.count(hash) > 0) return;
+
+    shard.probation.push_front(Entry{file_id, offset, std::move(block), false});
+    shard.entries.emplace(hash, shard.probation.begin());
+    shard.probation_bytes += shard.probation.front().block->size();
+    inserts.fetch_add(1, std::memory_order_relaxed);
+
+    evict(shard);
+}
+
+void BlockCache::evict(Shard& shard) {
+    while (shard.probation_bytes + shard.protected_bytes > shard_capacity) {
+        std::list<Entry>& victims = shard.probation.empty() ? shard.protected_ : shard.probation;
+        if (victims.empty()) break;
+
+        auto victim = std::prev(victims.end());
+        size_t bytes = victim->block->size();
+        (victim->is_protected ? shard.protected_bytes : shard.probation_bytes) -= bytes;
+
+        shard.entries.erase(hash_key(victim->file_id, victim->offset));
+        victims.erase(victim);
+        evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+BlockCacheStats BlockCache::stats() const {
+    BlockCacheStats s;
+    s.hits = hits.load(std::memory_order_relaxed);
+    s.misses = misses.load(std::memory_order_relaxed);
+    s.bytes_read = bytes_read.load(std::memory_order_relaxed);
+    s.evictions = evictions.load(std::memory_order_relaxed);
+    s.inserts = inserts.load(std::memory_order_relaxed);
+    s.capacity = shard_capacity * SHARD_COUNT;
+
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        s.bytes_cached += shard.probation_bytes + shard.protected_bytes;
+    }
+    return s;
+}
+
+void BlockCache::reset_stats() {
+    hits = 0;
+    misses = 0;
+    bytes_read = 0;
+    evictions = 0;
+    inserts = 0;
+}
+
+uint64_t BlockCache::file_id(const std::string& path) {
+    std::error_code ec;
+    auto canonical = std::filesystem::weakly_canonical(path, ec);
+    uint64_t id = std::hash<std::string>()(ec ? path : canonical.string());
+
+    // The path alone is not enough, compaction puts a new file with different contents under the same name
+#ifdef _WIN32
+    HANDLE h = CreateFileA(path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h != INVALID_HANDLE_VALUE) {
+        BY_HANDLE_FILE_INFORMATION info;
+        if (GetFileInformationByHandle(h, &info)) {
+            id ^= hash_key((static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow,
+                           info.dwVolumeSerialNumber);
+        }
+        CloseHandle(h);
+    }
+#else
+    struct stat st {};
+    if (stat(path.c_str(), &st) == 0) {
+        id ^= hash_key(static_cast<uint64_t>(st.st_ino), static_cast<uint64_t>(st.st_dev));
+    }
+#endif
+    return id;
+}
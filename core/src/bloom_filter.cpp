@@ -0,0 +1,183 @@
+#include "bloom_filter.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "random_access_file.hpp"
+
+BloomFilter::BloomFilter(size_t expected_keys, uint32_t bits_per_key)
+    : bits_per_key(bits_per_key) {
+    uint64_t bits = std::max<uint64_t>(expected_keys, 1) * bits_per_key;
+    block_count = std::max<uint64_t>((bits + 511) / 512, 1);
+
+    // k = ln 2 * bits per key minimises false positives
+    probes = std::clamp<uint32_t>(static_cast<uint32_t>(std::lround(bits_per_key * 0.69)), 1, 16);
+    words.assign(block_count * BLOCK_WORDS, 0);
+}
+
+uint64_t BloomFilter::hash(uint64_t key) {
+    // splitmix64 finalizer, keys are often consecutive ids
+    key += 0x9E3779B97F4A7C15ULL;
+    key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+    return key ^ (key >> 31);
+}
+
+// The low 18 bits pick the bits inside the block, the rest picks the block
+bool BloomFilter::block_contains(const uint64_t* block, uint64_t hash, uint32_t probes) {
+    uint32_t bit = hash & 511;
+    uint32_t step = ((hash >> 9) & 511) | 1;
+    for (uint32_t i = 0; i < probes; i++, bit = (bit + step) & 511) {
+        if ((block[bit / 64] & (1ULL << (bit % 64))) == 0) return false;
+    }
+    return true;
+}
+
+void BloomFilter::add(uint64_t key) {
+    uint64_t h = hash(key);
+    uint64_t* block = &words[((h >> 18) % block_count) * BLOCK_WORDS];
+
+    uint32_t bit = h & 511;
+    uint32_t step = ((h >> 9) & 511) | 1;
+    for (uint32_t i = 0; i < probes; i++, bit = (bit + step) & 511) {
+        block[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+bool BloomFilter::may_contain(uint64_t key) const {
+    if (words.empty()) return true;
+    uint64_t h = hash(key);
+    return block_contains(&words[((h >> 18) % block_count) * BLOCK_WORDS], h, probes);
+}
+
+
+static uint64_t load_u64(const char* data) {
+    uint64_t value;
+    std::memcpy(&value, data, sizeof(uint64_t));
+    return value;
+}
+
+bool BloomFilterSet::load(const std::string& bloom_file, uint64_t index_size) {
+    clear();
+
+    std::ifstream bloom_in(bloom_file, std::ios::binary | std::ios::in);
+    if (!bloom_in) return false;
+    std::string raw((std::istreambuf_iterator<char>(bloom_in)), std::istreambuf_iterator<char>());
+
+    uint64_t index_end = 0;
+    size_t pos = 0;
+    while (pos + BloomFilter::HEADER_SIZE <= raw.size()) {
+        const char* header = raw.data() + pos;
+        BloomFilter filter;
+        filter.block_count = load_u64(header + 2 * sizeof(uint64_t));
+        uint64_t params = load_u64(header + 3 * sizeof(uint64_t));
+        filter.probes = static_cast<uint32_t>(params);
+        filter.bits_per_key = static_cast<uint32_t>(params >> 32);
+
+        uint64_t end = load_u64(header + sizeof(uint64_t));
+        size_t bytes = filter.block_count * BloomFilter::BLOCK_WORDS * sizeof(uint64_t);
+        if (load_u64(header) != BloomFilter::MAGIC || end <= index_end ||
+            filter.block_count == 0 || bytes > raw.size() - pos - BloomFilter::HEADER_SIZE) {
+            break;
+        }
+
+        filter.words.resize(filter.block_count * BloomFilter::BLOCK_WORDS);
+        std::memcpy(filter.words.data(), header + BloomFilter::HEADER_SIZE, bytes);
+        filters.push_back(std::move(filter));
+
+        index_end = end;
+        pos += BloomFilter::HEADER_SIZE + bytes;
+    }
+
+    // Filters that stop short of the index would miss keys, they are useless
+    if (pos != raw.size() || index_end != index_size || filters.empty()) {
+        clear();
+        return false;
+    }
+    loaded = true;
+    return true;
+}
+
+void BloomFilterSet::clear() {
+    filters.clear();
+    loaded = false;
+}
+
+bool BloomFilterSet::may_contain(uint64_t key) const {
+    if (!loaded) return true;
+    for (const auto& filter : filters) {
+        if (filter.may_contain(key)) return true;
+    }
+    return false;
+}
+
+uint32_t BloomFilterSet::get_bits_per_key() const {
+    return loaded ? filters.back().bits_per_key : 0;
+}
+
+bool BloomFilterSet::write_filter(std::ofstream& out, const BloomFilter& filter, uint64_t index_end) {
+    uint64_t header[4] = {
+        BloomFilter::MAGIC, index_end, filter.block_count,
+        filter.probes | (static_cast<uint64_t>(filter.bits_per_key) << 32)
+    };
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(filter.words.data()), filter.words.size() * sizeof(uint64_t));
+    out.flush();
+    return static_cast<bool>(out);
+}
+
+bool BloomFilterSet::append(const std::string& bloom_file, BloomFilter filter, uint64_t index_end) {
+    std::ofstream bloom_out(bloom_file, std::ios::binary | std::ios::out | std::ios::app);
+    if (!bloom_out || !write_filter(bloom_out, filter, index_end)) {
+        clear();
+        return false;
+    }
+    filters.push_back(std::move(filter));
+    loaded = true;
+    return true;
+}
+
+bool BloomFilterSet::reset(const std::string& bloom_file, BloomFilter filter, uint64_t index_end) {
+    clear();
+    std::ofstream bloom_out(bloom_file, std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!bloom_out || !write_filter(bloom_out, filter, index_end)) {
+        return false;
+    }
+    filters.push_back(std::move(filter));
+    loaded = true;
+    return true;
+}
+
+bool BloomFilterSet::file_may_contain(const std::string& bloom_file, uint64_t index_size, uint64_t key) {
+    RandomAccessFile bloom_in;
+    if (!bloom_in.open(bloom_file)) return true;
+
+    uint64_t h = BloomFilter::hash(key);
+    uint64_t pos = 0;
+    uint64_t index_end = 0;
+    bool found = false;
+
+    // Every filter has to be visited anyway to validate the chain, so keep going after a match
+    char header[BloomFilter::HEADER_SIZE];
+    while (bloom_in.read_at(pos, header, sizeof(header))) {
+        uint64_t block_count = load_u64(header + 2 * sizeof(uint64_t));
+        uint32_t probes = static_cast<uint32_t>(load_u64(header + 3 * sizeof(uint64_t)));
+        uint64_t end = load_u64(header + sizeof(uint64_t));
+        if (load_u64(header) != BloomFilter::MAGIC || end <= index_end || block_count == 0) return true;
+
+        uint64_t block[BloomFilter::BLOCK_WORDS];
+        uint64_t block_pos = pos + BloomFilter::HEADER_SIZE + ((h >> 18) % block_count) * sizeof(block);
+        if (!bloom_in.read_at(block_pos, reinterpret_cast<char*>(block), sizeof(block))) return true;
+        found = found || BloomFilter::block_contains(block, h, probes);
+
+        index_end = end;
+        pos += BloomFilter::HEADER_SIZE + block_count * sizeof(block);
+    }
+
+    // A filter cut short by a crash may be missing bits of the keys it claims
+    std::error_code ec;
+    return found || index_end != index_size || pos != std::filesystem::file_size(bloom_file, ec);
+}
@@ -0,0 +1,79 @@
+#include "doc_id_map.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include "random_access_file.hpp"
+
+std::optional<uint32_t> DocIdMap::add(uint64_t key) {
+    if (!keys.empty() && key <= keys.back()) {
+        if (key == keys.back()) return static_cast<uint32_t>(keys.size() - 1);
+        return std::nullopt;
+    }
+    if (keys.size() > UINT32_MAX) {
+        return std::nullopt;
+    }
+    keys.push_back(key);
+    return static_cast<uint32_t>(keys.size() - 1);
+}
+
+std::optional<uint32_t> DocIdMap::doc_number(uint64_t key) const {
+    auto it = std::lower_bound(keys.begin(), keys.end(), key);
+    if (it == keys.end() || *it != key) return std::nullopt;
+    return static_cast<uint32_t>(it - keys.begin());
+}
+
+bool DocIdMap::save(const std::string& path) const {
+    // Written beside the target and renamed over it, readers never see a half written map
+    std::string tmp_file = path + ".tmp";
+    {
+        std::ofstream out(tmp_file, std::ios::binary | std::ios::out | std::ios::trunc);
+        uint64_t header[2] = {MAGIC, keys.size()};
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(keys.data()), keys.size() * sizeof(uint64_t));
+        if (!out) {
+            std::cerr << "STORAGE: Could not write " << tmp_file << std::endl;
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    RandomAccessFile::sync_file(tmp_file);
+    std::filesystem::rename(tmp_file, path, ec);
+    if (ec) {
+        std::cerr << "STORAGE: Could not replace " << path << ": " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool DocIdMap::load(const std::string& path) {
+    keys.clear();
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+
+    uint64_t header[2];
+    if (!in.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != MAGIC) {
+        std::cerr << "STORAGE: " << path << " is not a doc id map" << std::endl;
+        return false;
+    }
+
+    std::error_code ec;
+    uint64_t file_size = std::filesystem::file_size(path, ec);
+    if (ec || header[1] != (file_size - sizeof(header)) / sizeof(uint64_t)) {
+        std::cerr << "STORAGE: " << path << " is truncated" << std::endl;
+        return false;
+    }
+
+    keys.resize(header[1]);
+    if (!in.read(reinterpret_cast<char*>(keys.data()), keys.size() * sizeof(uint64_t)) ||
+        !std::is_sorted(keys.begin(), keys.end())) {
+        std::cerr << "STORAGE: " << path << " is damaged" << std::endl;
+        keys.clear();
+        return false;
+    }
+    return true;
+}
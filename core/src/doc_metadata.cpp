@@ -0,0 +1,209 @@
+#include "doc_metadata.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "post.hpp"
+#include "random_access_file.hpp"
+
+// Start of every column for a given row count, in file order
+struct ColumnOffsets {
+    uint64_t post_id;
+    uint64_t parent_id;
+    uint64_t score;
+    uint64_t view_count;
+    uint64_t answer_count;
+    uint64_t comment_count;
+    uint64_t creation_date;
+    uint64_t last_activity_date;
+    uint64_t post_type_id;
+    uint64_t end;
+};
+
+static ColumnOffsets column_offsets(uint64_t rows) {
+    uint64_t pos = DocMetadata::HEADER_SIZE;
+    auto next = [&](size_t width) {
+        uint64_t start = (pos + 7) & ~uint64_t(7);
+        pos = start + rows * width;
+        return start;
+    };
+
+    ColumnOffsets offsets{};
+    offsets.post_id = next(sizeof(uint32_t));
+    offsets.parent_id = next(sizeof(uint32_t));
+    offsets.score = next(sizeof(int32_t));
+    offsets.view_count = next(sizeof(uint32_t));
+    offsets.answer_count = next(sizeof(uint32_t));
+    offsets.comment_count = next(sizeof(uint32_t));
+    offsets.creation_date = next(sizeof(int64_t));
+    offsets.last_activity_date = next(sizeof(int64_t));
+    offsets.post_type_id = next(sizeof(uint8_t));
+    offsets.end = pos;
+    return offsets;
+}
+
+bool DocMetadata::generate(const std::string& path, const ISAMStorage& data_index, const DocIdMap& doc_ids) {
+    size_t rows = doc_ids.size();
+    std::vector<uint32_t> post_ids(rows), parent_ids(rows), view_counts(rows), answer_counts(rows), comment_counts(rows);
+    std::vector<int32_t> scores(rows);
+    std::vector<int64_t> creation_dates(rows), last_activity_dates(rows);
+    std::vector<uint8_t> post_type_ids(rows);
+
+    // Doc numbers follow key order, so this walks the data index front to back
+    std::string scratch, converted;
+    for (uint32_t doc = 0; doc < rows; doc++) {
+        auto record = data_index.read_view(doc_ids.key(doc), scratch);
+        auto post = record ? PostView::from_record(record->second, converted) : std::nullopt;
+        if (!post.has_value()) {
+            std::cerr << "STORAGE: No readable post for doc " << doc << ", its metadata is left empty" << std::endl;
+            continue;
+        }
+        post_ids[doc] = post->post_id();
+        parent_ids[doc] = post->parent_id().value_or(0);
+        scores[doc] = post->score();
+        view_counts[doc] = post->view_count();
+        answer_counts[doc] = post->answer_count();
+        comment_counts[doc] = post->comment_count();
+        creation_dates[doc] = parse_date(post->creation_date());
+        last_activity_dates[doc] = parse_date(post->last_activity_date());
+        post_type_ids[doc] = static_cast<uint8_t>(post->post_type_id());
+    }
+
+    // Written beside the target and renamed over it, readers never see a half written file
+    std::string tmp_file = path + ".tmp";
+    {
+        std::ofstream out(tmp_file, std::ios::binary | std::ios::out | std::ios::trunc);
+        if (!out) {
+            std::cerr << "STORAGE: Could not write " << tmp_file << std::endl;
+            return false;
+        }
+
+        uint64_t header[2] = {MAGIC, post_ids.size()};
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+        uint64_t pos = HEADER_SIZE;
+        auto write_column = [&](uint64_t start, const void* data, size_t bytes) {
+            static const char padding[8] = {};
+            out.write(padding, static_cast<std::streamsize>(start - pos));
+            out.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+            pos = start + bytes;
+        };
+
+        ColumnOffsets offsets = column_offsets(post_ids.size());
+        write_column(offsets.post_id, post_ids.data(), post_ids.size() * sizeof(uint32_t));
+        write_column(offsets.parent_id, parent_ids.data(), parent_ids.size() * sizeof(uint32_t));
+        write_column(offsets.score, scores.data(), scores.size() * sizeof(int32_t));
+        write_column(offsets.view_count, view_counts.data(), view_counts.size() * sizeof(uint32_t));
+        write_column(offsets.answer_count, answer_counts.data(), answer_counts.size() * sizeof(uint32_t));
+        write_column(offsets.comment_count, comment_counts.data(), comment_counts.size() * sizeof(uint32_t));
+        write_column(offsets.creation_date, creation_dates.data(), creation_dates.size() * sizeof(int64_t));
+        write_column(offsets.last_activity_date, last_activity_dates.data(),
+                     last_activity_dates.size() * sizeof(int64_t));
+        write_column(offsets.post_type_id, post_type_ids.data(), post_type_ids.size());
+
+        if (!out) {
+            std::cerr << "STORAGE: Could not write " << tmp_file << std::endl;
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    RandomAccessFile::sync_file(tmp_file);
+    std::filesystem::rename(tmp_file, path, ec);
+    if (ec) {
+        std::cerr << "STORAGE: Could not replace " << path << ": " << ec.message() << std::endl;
+        return false;
+    }
+
+    std::cout << "STORAGE: Wrote metadata of " << post_ids.size() << " posts." << std::endl;
+    return true;
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = static_cast<unsigned>(y - era * 400);
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+int64_t DocMetadata::parse_date(std::string_view date) {
+    // YYYY-MM-DDTHH:MM:SS, fractions of a second are dropped
+    if (date.size() < 19 || date[4] != '-' || date[7] != '-' || (date[10] != 'T' && date[10] != ' ') ||
+        date[13] != ':' || date[16] != ':') {
+        return 0;
+    }
+
+    auto number = [&](size_t pos, size_t digits, int64_t& value) {
+        value = 0;
+        for (size_t i = pos; i < pos + digits; i++) {
+            if (date[i] < '0' || date[i] > '9') return false;
+            value = value * 10 + (date[i] - '0');
+        }
+        return true;
+    };
+
+    int64_t year, month, day, hour, minute, second;
+    if (!number(0, 4, year) || !number(5, 2, month) || !number(8, 2, day) ||
+        !number(11, 2, hour) || !number(14, 2, minute) || !number(17, 2, second)) {
+        return 0;
+    }
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) {
+        return 0;
+    }
+
+    return days_from_civil(year, static_cast<unsigned>(month), static_cast<unsigned>(day)) * 86400 +
+           hour * 3600 + minute * 60 + second;
+}
+
+bool DocMetadata::open(const std::string& path) {
+    close();
+
+    if (!file.open(path)) {
+        std::cerr << "STORAGE: Could not open " << path << std::endl;
+        return false;
+    }
+
+    uint64_t header[2];
+    if (file.size() < HEADER_SIZE) {
+        std::cerr << "STORAGE: " << path << " is not a metadata file" << std::endl;
+        close();
+        return false;
+    }
+    std::memcpy(header, file.data(), sizeof(header));
+
+    // A row count that does not match the file size means a damaged file, guard the overflow first
+    ColumnOffsets offsets = column_offsets(header[1]);
+    if (header[0] != MAGIC || header[1] > file.size() || offsets.end > file.size()) {
+        std::cerr << "STORAGE: " << path << " is not a metadata file" << std::endl;
+        close();
+        return false;
+    }
+
+    const char* base = file.data();
+    rows = header[1];
+    post_ids = reinterpret_cast<const uint32_t*>(base + offsets.post_id);
+    parent_ids = reinterpret_cast<const uint32_t*>(base + offsets.parent_id);
+    scores = reinterpret_cast<const int32_t*>(base + offsets.score);
+    view_counts = reinterpret_cast<const uint32_t*>(base + offsets.view_count);
+    answer_counts = reinterpret_cast<const uint32_t*>(base + offsets.answer_count);
+    comment_counts = reinterpret_cast<const uint32_t*>(base + offsets.comment_count);
+    creation_dates = reinterpret_cast<const int64_t*>(base + offsets.creation_date);
+    last_activity_dates = reinterpret_cast<const int64_t*>(base + offsets.last_activity_date);
+    post_type_ids = reinterpret_cast<const uint8_t*>(base + offsets.post_type_id);
+    return true;
+}
+
+void DocMetadata::close() {
+    file.close();
+    rows = 0;
+    post_ids = parent_ids = view_counts = answer_counts = comment_counts = nullptr;
+    scores = nullptr;
+    creation_dates = last_activity_dates = nullptr;
+    post_type_ids = nullptr;
+}
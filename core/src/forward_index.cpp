@@ -5,25 +5,26 @@
 #include "isam_storage.hpp"
 #include "lexicon.hpp"
 #include "post.hpp"
-#include "nlohmann/json.hpp"
+#include "tokenizer.hpp"
 
 void
 ForwardIndex::generate(ISAMStorage& output_store,
-                       ISAMStorage& data_index,
+                       const ISAMStorage& data_index,
                        Lexicon& lexicon)
 {
-    std::vector<std::pair<uint64_t, std::string>> result;
-    result.reserve(data_index.size());
+    // Entries are written out as they are produced
+    auto writer = output_store.bulk_writer();
 
     int c = 0;
+    auto cursor = data_index.scan_prefix(KeyType::POST_BY_ID);
+    std::string converted; // Only used for JSON records
     while (true) {
-        auto p = data_index.next();
+        auto p = cursor.next();
         if (!p.has_value()) break;
 
-        std::string raw = p->second;
-
-        nlohmann::json j = nlohmann::json::parse(raw);
-        Post post = Post::from_json(j);
+        // Fields are read straight out of the record
+        auto post = PostView::from_record(p->second, converted);
+        if (!post.has_value()) continue;
 
         std::string data = "";
 
@@ -36,28 +37,28 @@ ForwardIndex::generate(ISAMStorage& output_store,
         // 3 = Tag
 
         //  TITLE 
-        if (post.post_type_id == 1) {
-            auto t_tokens = Lexicon::tokenize_text(post.title);
-            for (auto& t : t_tokens) {
-                uint64_t wid = lexicon.get_word_id(t);
+        if (post->post_type_id() == 1) {
+            Tokenizer t_tokens(post->title());
+            while (auto t = t_tokens.next()) {
+                uint64_t wid = lexicon.get_word_id(*t);
                 data += std::to_string(wid) + ",1 ";
             }
         }
 
         //  BODY 
-        auto b_tokens = Lexicon::tokenize_text(post.cleaned_body);
-        for (auto& t : b_tokens) {
-            uint64_t wid = lexicon.get_word_id(t);
+        Tokenizer b_tokens(post->cleaned_body());
+        while (auto t = b_tokens.next()) {
+            uint64_t wid = lexicon.get_word_id(*t);
             data += std::to_string(wid) + ",2 ";
         }
 
         //TAGS 
-        for (auto& t : post.tags) {
-            uint64_t wid = lexicon.get_word_id(t);
+        for (uint32_t i = 0; i < post->tag_count(); i++) {
+            uint64_t wid = lexicon.get_word_id(post->tag(i));
             data += std::to_string(wid) + ",3 ";
         }
 
-        result.emplace_back(p->first, data);
+        writer.append(p->first, data);
 
         std::cout << "\rIndexed " << (c + 1)
                   << " entries in forward index." << std::flush;
@@ -66,7 +67,7 @@ ForwardIndex::generate(ISAMStorage& output_store,
     }
     std::cout << std::endl;
 
-    std::cout << "Writing entries to disk";
-    output_store.write(result);
+    std::cout << "Writing index to disk...";
+    writer.finish();
     std::cout << "done." << std::endl;
 }
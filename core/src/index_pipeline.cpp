@@ -0,0 +1,240 @@
+#include "index_pipeline.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.hpp"
+#include "post.hpp"
+#include "tokenizer.hpp"
+#include "utils.hpp"
+#include "xml_row_reader.hpp"
+
+// Bytes of Posts.xml per batch
+static constexpr size_t BATCH_CHUNK_SIZE = 256 * 1024;
+
+// A post on its way through the stages, the tokens are filled in by the tokenize stage
+struct PipelinePost {
+    Post post;
+    TokenList title_tokens;
+    TokenList body_tokens;
+    std::vector<std::string> normalized_tags;
+};
+
+struct PipelineBatch {
+    uint64_t sequence = 0;
+    std::string xml;
+    std::vector<PipelinePost> posts;
+};
+
+using batch_queue_t = BoundedQueue<std::unique_ptr<PipelineBatch> >;
+
+// Runs work on threads workers that pop from in and push to out, out is closed when the last one is done
+template <typename Work>
+static void start_stage(std::vector<std::thread>& threads, int workers, batch_queue_t& in, batch_queue_t& out,
+                        std::atomic<int>& active, Work work) {
+    workers = std::max(workers, 1);
+    active.store(workers);
+    for (int w = 0; w < workers; w++) {
+        threads.emplace_back([&in, &out, &active, work]() {
+            std::unique_ptr<PipelineBatch> batch;
+            while (in.pop(batch)) {
+                work(*batch);
+                out.push(std::move(batch));
+            }
+            if (active.fetch_sub(1, std::memory_order_acq_rel) == 1) out.close();
+        });
+    }
+}
+
+bool IndexPipeline::run(const std::string& post_file, ISAMStorage& data_index, ISAMStorage& forward_index,
+                        Lexicon& lexicon, ReverseIndex& reverse_index, const Options& options) {
+    XmlRowReader reader;
+    if (!reader.open(post_file)) {
+        std::cerr << "Could not open " << post_file << std::endl;
+        return false;
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    batch_queue_t chunks(options.queue_capacity);
+    batch_queue_t parsed(options.queue_capacity);
+    batch_queue_t cleaned(options.queue_capacity);
+    batch_queue_t tokenized(options.queue_capacity);
+
+    // The index stage reports how far it got, the reader stays at most this many batches ahead of it.
+    // That bounds the batches waiting to be put back in order when one of them is slow
+    const uint64_t window = 4 * options.queue_capacity;
+    std::atomic<uint64_t> indexed{0};
+    std::atomic<bool> failed{false};
+    std::atomic<uint64_t> skipped_rows{0};
+
+    std::vector<std::thread> threads;
+    threads.emplace_back([&]() {
+        uint64_t sequence = 0;
+        while (!failed.load(std::memory_order_relaxed)) {
+            while (sequence >= indexed.load(std::memory_order_acquire) + window &&
+                   !failed.load(std::memory_order_relaxed)) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+
+            auto chunk = reader.next_chunk(BATCH_CHUNK_SIZE);
+            if (!chunk.has_value()) break;
+
+            auto batch = std::make_unique<PipelineBatch>();
+            batch->sequence = sequence++;
+            batch->xml = std::move(*chunk);
+            chunks.push(std::move(batch));
+        }
+        skipped_rows += reader.skipped_rows();
+        chunks.close();
+    });
+
+    std::atomic<int> parse_active{0};
+    std::atomic<int> clean_active{0};
+    std::atomic<int> tokenize_active{0};
+    SiteID site_id = options.site_id;
+
+    start_stage(threads, options.parse_threads, chunks, parsed, parse_active, [site_id, &skipped_rows](PipelineBatch& batch) {
+        thread_local XmlRowReader parser;
+        parser.open_buffer(std::move(batch.xml));
+        batch.xml.clear();
+        while (auto row = parser.next()) {
+            batch.posts.push_back({Utils::post_from_row(*row, site_id, false), {}, {}, {}});
+        }
+        skipped_rows += parser.skipped_rows();
+    });
+
+    start_stage(threads, options.clean_threads, parsed, cleaned, clean_active, [](PipelineBatch& batch) {
+        for (auto& item : batch.posts) {
+            Utils::extract_text_from_html(item.post.body, item.post.cleaned_body);
+        }
+    });
+
+    // Same tokens the lexicon and forward index passes produce
+    start_stage(threads, options.tokenize_threads, cleaned, tokenized, tokenize_active, [](PipelineBatch& batch) {
+        for (auto& item : batch.posts) {
+            if (item.post.post_type_id == 1) {
+                item.title_tokens.tokenize(item.post.title);
+            }
+            item.body_tokens.tokenize(item.post.cleaned_body);
+            for (const auto& tag : item.post.tags) {
+                item.normalized_tags.push_back(Lexicon::normalize_token(tag));
+            }
+        }
+    });
+
+    // INDEX STAGE, on this thread
+    auto data_writer = data_index.bulk_writer();
+    auto forward_writer = forward_index.bulk_writer();
+
+    std::map<uint64_t, std::unique_ptr<PipelineBatch> > waiting;
+    uint64_t next_sequence = 0;
+    uint64_t last_key = 0;
+    size_t count = 0;
+
+    std::string record;
+    std::vector<std::pair<uint32_t, uint8_t> > words;
+    // Looked up in the lexicon built so far, see the header for the one case where that differs
+    auto add_hit = [&](std::string_view token, uint8_t mask) {
+        uint32_t word_id = static_cast<uint32_t>(lexicon.get_word_id(token));
+        record += std::to_string(word_id) + "," + std::to_string(mask) + " ";
+        words.emplace_back(word_id, mask);
+    };
+    auto add_words = [&](const TokenList& tokens) {
+        for (size_t i = 0; i < tokens.size(); i++) lexicon.add_word(tokens[i]);
+    };
+
+    auto index_post = [&](PipelinePost& item) {
+        const Post& post = item.post;
+        uint64_t key = CompoundKey(static_cast<uint8_t>(KeyType::POST_BY_ID), static_cast<uint16_t>(site_id),
+                                   post.post_id, 0).pack();
+        if (count > 0 && key <= last_key) {
+            std::cerr << "Post " << post.post_id << " is out of order, Posts.xml has to be sorted by Id "
+                      << "for a pipelined build. Use the separate generation steps instead." << std::endl;
+            failed = true;
+            return;
+        }
+        last_key = key;
+
+        data_writer.append(key, Post::to_binary(post));
+
+        // Lexicon: title, body and tags of questions, the body of answers (see Utils::generate_lexicon)
+        if (post.post_type_id == 1) {
+            add_words(item.title_tokens);
+            add_words(item.body_tokens);
+            std::vector<std::string> n_tags;
+            n_tags.reserve(post.tags.size());
+            for (auto& tag : item.normalized_tags) {
+                n_tags.emplace_back(std::move(tag));
+            }
+            lexicon.add_words(n_tags);
+        } else if (post.post_type_id == 2) {
+            add_words(item.body_tokens);
+        }
+
+        // Forward record in the format of ForwardIndex::generate
+        record.clear();
+        words.clear();
+        for (size_t i = 0; i < item.title_tokens.size(); i++) add_hit(item.title_tokens[i], 1);
+        for (size_t i = 0; i < item.body_tokens.size(); i++) add_hit(item.body_tokens[i], 2);
+        for (const auto& tag : post.tags) add_hit(tag, 3);
+        forward_writer.append(key, record);
+
+        reverse_index.add_document(key, words);
+        count++;
+    };
+
+    std::unique_ptr<PipelineBatch> batch;
+    while (tokenized.pop(batch)) {
+        uint64_t sequence = batch->sequence;
+        waiting.emplace(sequence, std::move(batch));
+
+        // Batches finish out of order, they are indexed in file order
+        for (auto it = waiting.find(next_sequence); it != waiting.end(); it = waiting.find(next_sequence)) {
+            if (!failed.load(std::memory_order_relaxed)) {
+                for (auto& item : it->second->posts) {
+                    index_post(item);
+                    if (failed.load(std::memory_order_relaxed)) break;
+                }
+            }
+            waiting.erase(it);
+            next_sequence++;
+            indexed.store(next_sequence, std::memory_order_release);
+        }
+        if (count > 0) {
+            std::cout << "\rIndexed " << count << " posts." << std::flush;
+        }
+    }
+
+    for (auto& thread : threads) thread.join();
+    std::cout << std::endl;
+
+    if (skipped_rows.load() > 0) {
+        std::cerr << "Skipped " << skipped_rows.load() << " malformed rows in " << post_file << std::endl;
+    }
+
+    // A failed run leaves the stores as they were, nothing points at half an index
+    if (failed.load()) {
+        data_writer.abort();
+        forward_writer.abort();
+        std::cerr << "Pipelined build failed, the data and forward index were not written." << std::endl;
+        return false;
+    }
+
+    std::cout << "Writing data and forward index to disk...";
+    data_writer.finish();
+    forward_writer.finish();
+    std::cout << "done." << std::endl;
+
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    std::cout << "Pipeline indexed " << count << " posts in " << seconds << "s, " << lexicon.size() - 1
+              << " words, " << reverse_index.total_terms() << " terms in the barrels." << std::endl;
+
+    return true;
+}
@@ -1,12 +1,22 @@
 #include "isam_storage.hpp"
 
 #include <algorithm>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <thread>
 
 #include "iostream"
 
 #include <filesystem>
+#include <lz4.h>
 
-ISAMStorage::ISAMStorage(std::string index_file, std::string data_file) {
+// Compressed stores: the low bits of an index offset are the record's position inside its block
+static constexpr int BLOCK_OFFSET_BITS = 16;
+static constexpr uint64_t BLOCK_OFFSET_MASK = (1ULL << BLOCK_OFFSET_BITS) - 1;
+
+ISAMStorage::ISAMStorage(std::string index_file, std::string data_file, ISAMOptions options)
+    : index_file(index_file), data_file(data_file), options(options), loaded_indexes(options.lookup_layout) {
     // Check if exists
     // if (!std::filesystem::exists(index_file)) {
     //     throw std::invalid_argument("The file [" + index_file + "] does not exist.");
@@ -15,23 +25,100 @@ ISAMStorage::ISAMStorage(std::string index_file, std::string data_file) {
     //     throw std::invalid_argument("The file [" + data_file + "] does not exist.");
     // }
 
+    recover_compaction(index_file, data_file);
+
     index_out.open(index_file, std::ios::binary | std::ios::out | std::ios::app);
     data_out.open(data_file, std::ios::binary | std::ios::out | std::ios::app);
 
-    // Open descriptors
-    index_in.open(index_file, std::ios::binary | std::ios::in);
-    data_in.open(data_file, std::ios::binary | std::ios::in);
+    std::error_code ec;
+    data_end = std::filesystem::file_size(data_file, ec);
+    if (ec) data_end = 0;
 
+    init_data_format();
 
+    // Open descriptors
+    if (options.use_mmap) {
+        if (!data_map.open(data_file)) {
+            std::cerr << "STORAGE: Could not map [" << data_file << "]" << std::endl;
+        }
+    } else {
+        data_in.open(data_file);
+    }
+    if (options.block_cache) data_file_id = BlockCache::file_id(data_file);
 
     load_index_file();
+    filters.load(BloomFilter::file_path(index_file), std::filesystem::file_size(index_file, ec));
 }
 
-uint32_t ISAMStorage::size() {
-    return loaded_indexes.size();
+uint32_t ISAMStorage::size() const {
+    return sparse ? sparse_index.size() : loaded_indexes.size();
 }
 
 
+// Sorts by key and drops superseded entries, among equal keys the one written last wins
+static void sort_and_deduplicate(std::vector<std::pair<uint64_t, uint64_t> >& entries) {
+    std::stable_sort(entries.begin(), entries.end(),
+    [](const std::pair<uint64_t, uint64_t>& a, const std::pair<uint64_t, uint64_t>& b) {
+        return a.first < b.first;
+    });
+
+    size_t out = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (i + 1 < entries.size() && entries[i + 1].first == entries[i].first) continue;
+        entries[out++] = entries[i];
+    }
+    entries.resize(out);
+}
+
+// Parses the index file contents, each write() left one segment behind
+void ISAMStorage::parse_index(const char* data, size_t size, std::vector<std::pair<uint64_t, uint64_t> >& entries) {
+    const size_t entry_size = 2 * sizeof(uint64_t);
+
+    auto read_entry = [&](size_t pos) {
+        uint64_t raw_key;
+        uint64_t offset;
+        std::memcpy(&raw_key, data + pos, sizeof(uint64_t));
+        std::memcpy(&offset, data + pos + sizeof(uint64_t), sizeof(uint64_t));
+        return std::make_pair(raw_key, offset);
+    };
+
+    uint64_t magic = 0;
+    if (size >= sizeof(uint64_t)) {
+        std::memcpy(&magic, data, sizeof(uint64_t));
+    }
+
+    // Files written before segments existed are a flat list of entries
+    if (size > 0 && magic != SEGMENT_MAGIC) {
+        legacy_index = true;
+        entries.reserve(size / entry_size);
+        for (size_t pos = 0; pos + entry_size <= size; pos += entry_size) {
+            entries.push_back(read_entry(pos));
+        }
+        return;
+    }
+
+    size_t pos = 0;
+    while (pos + SEGMENT_HEADER_SIZE <= size) {
+        uint64_t count;
+        std::memcpy(&magic, data + pos, sizeof(uint64_t));
+        std::memcpy(&count, data + pos + sizeof(uint64_t), sizeof(uint64_t));
+
+        // A torn segment (crash during write) is ignored, the data it points to is unreachable
+        if (magic != SEGMENT_MAGIC || count > (size - pos - SEGMENT_HEADER_SIZE) / entry_size) {
+            std::cerr << "STORAGE: Ignoring damaged index segment at offset " << pos
+                      << " in [" << index_file << "]" << std::endl;
+            break;
+        }
+        pos += SEGMENT_HEADER_SIZE;
+
+        entries.reserve(entries.size() + count);
+        for (uint64_t i = 0; i < count; i++, pos += entry_size) {
+            entries.push_back(read_entry(pos));
+        }
+        segment_count++;
+    }
+}
+
 void ISAMStorage::load_index_file() {
 
     if (index_loaded) {
@@ -39,151 +126,1135 @@ void ISAMStorage::load_index_file() {
         return;
     }
 
+    if (options.sparse_index_interval > 0) {
+        if (sparse_index.open(index_file, options.sparse_index_interval, options.use_mmap, options.block_cache)) {
+            sparse = true;
+            segment_count = 1;
+            index_loaded = true;
+            return;
+        }
 
+        std::error_code ec;
+        if (std::filesystem::exists(index_file, ec)) {
+            std::cout << "STORAGE: [" << index_file << "] is not a single segment, loading the full index "
+                      << "(compact the store to enable the sparse index)." << std::endl;
+        }
+    }
 
-    while (index_in.peek() != EOF) {
-        uint64_t raw_key;
-        uint64_t offset;
+    load_full_index();
+    index_loaded = true;
+}
 
-        index_in.read(reinterpret_cast<char*>(&raw_key), sizeof(uint64_t));
-        index_in.read(reinterpret_cast<char*>(&offset), sizeof(uint64_t));
+void ISAMStorage::load_full_index() {
+    std::vector<std::pair<uint64_t, uint64_t> > entries;
+    segment_count = 0;
+    legacy_index = false;
 
-        // Check if reads succeeded
-        if (!index_in) break;
+    if (options.use_mmap) {
+        // The index is copied out once, the mapping is not needed afterwards
+        MappedFile index_map;
+        if (index_map.open(index_file)) {
+            parse_index(index_map.data(), index_map.size(), entries);
+        }
+    } else {
+        std::ifstream index_in(index_file, std::ios::binary | std::ios::in);
 
-        loaded_indexes.emplace_back(raw_key, offset);
+        // One bulk read instead of two small reads per entry
+        std::string raw((std::istreambuf_iterator<char>(index_in)), std::istreambuf_iterator<char>());
+        parse_index(raw.data(), raw.size(), entries);
     }
 
-    if (!std::is_sorted(loaded_indexes.begin(), loaded_indexes.end(),
-        [](const std::pair<uint64_t, uint64_t>& a, const std::pair<uint64_t, uint64_t>& b) {
-            return a.first < b.first;
-        })) {
+    // Every segment is sorted on its own, a single one can be used as is
+    if (legacy_index || segment_count > 1) {
+        size_t total = entries.size();
+        sort_and_deduplicate(entries);
+        std::cout << "STORAGE: Merged " << (legacy_index ? "legacy index" : std::to_string(segment_count) + " segments")
+                  << ", " << total << " entries -> " << entries.size() << " keys." << std::endl;
+    }
 
-        std::sort(loaded_indexes.begin(), loaded_indexes.end(),
-        [](const std::pair<uint64_t, uint64_t>& a, const std::pair<uint64_t, uint64_t>& b) {
-            return a.first < b.first;
-        });
-        std::cout << "STORAGE: Index was unsorted, sorted " << loaded_indexes.size() << " entries." << std::endl;
-    } else {
-        std::cout << "STORAGE: Index already sorted, skipping sort" << std::endl;
+    loaded_indexes.assign(entries);
+}
+
+std::optional<uint64_t> ISAMStorage::find_offset(uint64_t key) const {
+    if (!filters.may_contain(key)) return std::nullopt;
+    return sparse ? sparse_index.find(key) : loaded_indexes.find(key);
+}
+
+size_t ISAMStorage::lower_bound_position(uint64_t key) const {
+    return sparse ? sparse_index.lower_bound(key) : loaded_indexes.lower_bound(key);
+}
+
+// Rewrites a pre-segment index file as a single segment so new segments can be appended after it
+void ISAMStorage::migrate_legacy_index() {
+    std::string tmp_file = index_file + ".tmp";
+    {
+        std::ofstream tmp_out(tmp_file, std::ios::binary | std::ios::out | std::ios::trunc);
+        write_segment(tmp_out, loaded_indexes.entries());
     }
 
-    index_loaded = true;
+    index_out.close();
+    std::filesystem::rename(tmp_file, index_file);
+    index_out.open(index_file, std::ios::binary | std::ios::out | std::ios::app);
+
+    legacy_index = false;
+    segment_count = 1;
+    std::cout << "STORAGE: Converted legacy index [" << index_file << "] to segment format." << std::endl;
+}
+
+void ISAMStorage::write_segment(std::ofstream& out, const std::vector<std::pair<uint64_t, uint64_t> >& entries) {
+    uint64_t magic = SEGMENT_MAGIC;
+    uint64_t count = entries.size();
+    out.write(reinterpret_cast<const char*>(&magic), sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(&count), sizeof(uint64_t));
+
+    for (const auto& entry : entries) {
+        uint64_t key = entry.first;
+        uint64_t offset = entry.second;
+        out.write(reinterpret_cast<const char*>(&key), sizeof(uint64_t));
+        out.write(reinterpret_cast<const char*>(&offset), sizeof(uint64_t));
+    }
+    out.flush();
 }
 
 
 ISAMStorage::~ISAMStorage() {
-    index_in.close();
     index_out.close();
 
     data_in.close();
     data_out.close();
+
+    data_map.close();
 }
 
-void ISAMStorage::write(std::vector<std::pair<uint64_t, std::string > > entries) {
+void ISAMStorage::init_data_format() {
+    if (data_end == 0) {
+        if (options.compression != ISAMOptions::Compression::LZ4) return;
 
-    std::vector<std::pair<uint64_t, uint64_t> > new_indexes;
+        block_size = std::clamp<uint32_t>(options.compression_block_size, 1, MAX_COMPRESSION_BLOCK);
+        uint64_t header[2] = {DATA_MAGIC, block_size};
+        data_out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        data_out.flush();
 
-    // Write all data, store indexes
-    for (auto p : entries) {
-        uint32_t len = p.second.size();
+        data_end = DATA_HEADER_SIZE;
+        compressed = true;
+        return;
+    }
 
-        // Store index
-        new_indexes.emplace_back(p.first, data_out.tellp());
+    // A plain file can't start with either magic, its first 4 bytes are a record length
+    uint64_t header[2] = {0, 0};
+    std::ifstream header_in(data_file, std::ios::binary | std::ios::in);
+    header_in.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (header_in && header[0] == DATA_MAGIC) {
+        block_size = std::clamp<uint32_t>(static_cast<uint32_t>(header[1]), 1, MAX_COMPRESSION_BLOCK);
+        compressed = true;
+    } else if (header_in && header[0] == DICT_DATA_MAGIC) {
+        dictionary_compressed = true;
+        dictionary = RecordDictionary::load(RecordDictionary::file_path(data_file));
+        if (!dictionary || dictionary->id() != header[1]) {
+            std::cerr << "STORAGE: The dictionary of [" << data_file << "] is missing or does not match, "
+                      << "its records can't be read." << std::endl;
+            dictionary.reset();
+        }
+    }
+}
 
-        // Write the 4-byte length field
-        data_out.write(reinterpret_cast<const char*>(&len), sizeof(uint32_t));
+bool ISAMStorage::set_dictionary(std::shared_ptr<const RecordDictionary> new_dictionary) {
+    bool empty = size() == 0 && pending_block.empty() &&
+                 (data_end == 0 || ((compressed || dictionary_compressed) && data_end == DATA_HEADER_SIZE));
+    if (!new_dictionary || !empty) {
+        std::cerr << "STORAGE: A dictionary can only be set on an empty store, [" << data_file << "] unchanged."
+                  << std::endl;
+        return false;
+    }
 
-        // Write data
-        data_out.write(p.second.c_str(), len);
+    if (!new_dictionary->save(RecordDictionary::file_path(data_file))) {
+        std::cerr << "STORAGE: Could not save the dictionary of [" << data_file << "]" << std::endl;
+        return false;
+    }
+
+    // Replace whatever header the empty file had
+    data_out.close();
+    data_out.open(data_file, std::ios::binary | std::ios::out | std::ios::trunc);
+    uint64_t header[2] = {DICT_DATA_MAGIC, new_dictionary->id()};
+    data_out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    data_out.close();
+    data_out.open(data_file, std::ios::binary | std::ios::out | std::ios::app);
+
+    data_end = DATA_HEADER_SIZE;
+    compressed = false;
+    dictionary_compressed = true;
+    dictionary = std::move(new_dictionary);
+
+    if (options.use_mmap) {
+        data_map.open(data_file);
+    } else if (!data_in.is_open()) {
+        data_in.open(data_file);
+    }
+    return true;
+}
+
+void ISAMStorage::flush_block() {
+    if (pending_block.empty()) return;
+
+    uint32_t raw_size = pending_block.size();
+    std::string packed(BLOCK_HEADER_SIZE + LZ4_compressBound(raw_size), '\0');
+    int packed_size = LZ4_compress_default(pending_block.data(), &packed[BLOCK_HEADER_SIZE], raw_size,
+                                           packed.size() - BLOCK_HEADER_SIZE);
+    if (packed_size <= 0) {
+        std::cerr << "STORAGE: Could not compress a block of " << raw_size << " bytes for [" << data_file << "]"
+                  << std::endl;
+    }
+
+    uint32_t header[2] = {static_cast<uint32_t>(std::max(packed_size, 0)), raw_size};
+    std::memcpy(&packed[0], header, BLOCK_HEADER_SIZE);
+    data_out.write(packed.data(), BLOCK_HEADER_SIZE + header[0]);
+
+    data_end += BLOCK_HEADER_SIZE + header[0];
+    pending_block.clear();
+}
+
+uint64_t ISAMStorage::append_record(std::string_view data) {
+    uint32_t len = data.size();
+
+    if (compressed) {
+        // A block is closed once it reaches the block size, so every record starts within the first 64KB
+        if (pending_block.size() >= block_size) flush_block();
+
+        uint64_t offset = (data_end << BLOCK_OFFSET_BITS) | pending_block.size();
+        pending_block.append(reinterpret_cast<const char*>(&len), sizeof(uint32_t));
+        pending_block.append(data.data(), len);
+        return offset;
+    }
+
+    if (dictionary_compressed) {
+        if (!dictionary || !dictionary->compress(data, packed_record)) {
+            std::cerr << "STORAGE: Could not compress a record for [" << data_file << "], stored empty." << std::endl;
+            packed_record.clear();
+        }
+        data = packed_record;
+        len = data.size();
+    }
+
+    uint64_t offset = data_end;
+
+    // Write the 4-byte length field
+    data_out.write(reinterpret_cast<const char*>(&len), sizeof(uint32_t));
+
+    // Write data
+    data_out.write(data.data(), len);
+
+    data_end += sizeof(uint32_t) + len;
+    return offset;
+}
+
+void ISAMStorage::begin_segment(bool merge_in_memory) {
+    // Records must be on disk before the index points at them
+    if (compressed) {
+        flush_block();
     }
     data_out.flush();
 
-    // Sort new indexes
-    std::sort(new_indexes.begin(), new_indexes.end(),
-    [](const std::pair<uint64_t, uint64_t>& a, const std::pair<uint64_t, uint64_t>& b) {
-        return a.first < b.first; // This is an overloaded operator that compares 64-bit keys
-    });
+    // Merging needs every key in memory
+    if (sparse) {
+        sparse_index.close();
+        sparse = false;
+        if (merge_in_memory) load_full_index();
+    }
 
-    // Merge with old indexes using std::merge
+    // The index file changes, its sparse top level would be stale
+    std::error_code ec;
+    std::filesystem::remove(SparseKeyIndex::top_file_path(index_file), ec);
+
+    if (legacy_index) {
+        migrate_legacy_index();
+    }
+}
+
+void ISAMStorage::reopen_data() {
+    // The old mapping does not cover the records that were just appended,
+    // a pread handle opened on a previously missing file is picked up here too
+    if (options.use_mmap) {
+        data_map.open(data_file);
+    } else if (!data_in.is_open()) {
+        data_in.open(data_file);
+    }
+}
+
+void ISAMStorage::commit_segment(const std::vector<std::pair<uint64_t, uint64_t> >& new_indexes) {
+    begin_segment(true);
+
+    // Append the batch as its own segment, the rest of the file is never touched
+    write_segment(index_out, new_indexes);
+    segment_count++;
+
+    // Merge with old indexes, new entries replace old ones with the same key
     std::vector<std::pair<uint64_t, uint64_t>> merged_indexes;
     merged_indexes.reserve(loaded_indexes.size() + new_indexes.size());
 
-    std::merge(loaded_indexes.begin(), loaded_indexes.end(),
-               new_indexes.begin(), new_indexes.end(),
-               std::back_inserter(merged_indexes),
-               [](const std::pair<uint64_t, uint64_t>& a, const std::pair<uint64_t, uint64_t>& b) {
-                   return a.first < b.first;
-               });
+    size_t old_pos = 0;
+    auto new_it = new_indexes.begin();
+    while (old_pos < loaded_indexes.size() && new_it != new_indexes.end()) {
+        uint64_t old_key = loaded_indexes.key_at(old_pos);
+        if (old_key < new_it->first) {
+            merged_indexes.emplace_back(old_key, loaded_indexes.offset_at(old_pos++));
+        } else {
+            if (old_key == new_it->first) ++old_pos;
+            merged_indexes.push_back(*new_it++);
+        }
+    }
+    for (; old_pos < loaded_indexes.size(); old_pos++) {
+        merged_indexes.emplace_back(loaded_indexes.key_at(old_pos), loaded_indexes.offset_at(old_pos));
+    }
+    merged_indexes.insert(merged_indexes.end(), new_it, new_indexes.end());
 
     // Assign merged result back to loaded_indexes
-    loaded_indexes = std::move(merged_indexes);
+    loaded_indexes.assign(merged_indexes);
 
+    update_filters(new_indexes);
+    reopen_data();
+}
 
-    // Write new indexes to file
-    index_out.seekp(0);
-    for (const auto& entry : loaded_indexes) {
-        uint64_t key = entry.first;
-        uint64_t offset = entry.second;
-        index_out.write(reinterpret_cast<const char*>(&key), sizeof(uint64_t));
-        index_out.write(reinterpret_cast<const char*>(&offset), sizeof(uint64_t));
+uint32_t ISAMStorage::filter_bits_per_key() const {
+    return options.bloom_bits_per_key > 0 ? options.bloom_bits_per_key : filters.get_bits_per_key();
+}
+
+void ISAMStorage::update_filters(const std::vector<std::pair<uint64_t, uint64_t> >& new_indexes) {
+    uint32_t bits_per_key = filter_bits_per_key();
+    if (bits_per_key == 0) {
+        // An out of date filter is ignored anyway, don't leave it lying around
+        std::error_code ec;
+        std::filesystem::remove(BloomFilter::file_path(index_file), ec);
+        return;
+    }
+
+    // A current filter only needs the new segment's keys, otherwise (first write, legacy index,
+    // filters switched on later) the filter is rebuilt from every key
+    bool incremental = filters.is_loaded();
+    BloomFilter filter(incremental ? new_indexes.size() : loaded_indexes.size(), bits_per_key);
+    if (incremental) {
+        for (const auto& entry : new_indexes) filter.add(entry.first);
+    } else {
+        for (size_t i = 0; i < loaded_indexes.size(); i++) filter.add(loaded_indexes.key_at(i));
+    }
+    store_filter(std::move(filter), incremental);
+}
+
+void ISAMStorage::store_filter(BloomFilter filter, bool incremental) {
+    std::string bloom_file = BloomFilter::file_path(index_file);
+    std::error_code ec;
+    uint64_t index_end = std::filesystem::file_size(index_file, ec);
+
+    bool written = incremental ? filters.append(bloom_file, std::move(filter), index_end)
+                               : filters.reset(bloom_file, std::move(filter), index_end);
+    if (!written) {
+        std::cerr << "STORAGE: Could not write the Bloom filter [" << bloom_file << "]" << std::endl;
+        std::filesystem::remove(bloom_file, ec);
+    }
+}
+
+void ISAMStorage::write(const std::vector<std::pair<uint64_t, std::string > >& entries) {
+    if (entries.empty()) return;
+
+    std::vector<std::pair<uint64_t, uint64_t> > new_indexes;
+    new_indexes.reserve(entries.size());
+
+    // Write all data, store indexes
+    for (const auto& p : entries) {
+        new_indexes.emplace_back(p.first, append_record(p.second));
+    }
+    data_out.flush();
+
+    // Sort new indexes, a key repeated within the batch keeps its last record
+    sort_and_deduplicate(new_indexes);
+
+    commit_segment(new_indexes);
+}
+
+ISAMStorage::BulkWriter ISAMStorage::bulk_writer(size_t memory_budget) {
+    return BulkWriter(*this, memory_budget);
+}
+
+ISAMStorage::BulkWriter::BulkWriter(ISAMStorage& store, size_t memory_budget)
+    : store(store),
+      max_buffered(std::max<size_t>(memory_budget / sizeof(std::pair<uint64_t, uint64_t>), 1024)),
+      start_data_end(store.data_end),
+      start_pending_block(store.pending_block.size()) {
+}
+
+ISAMStorage::BulkWriter::~BulkWriter() {
+    finish();
+}
+
+void ISAMStorage::BulkWriter::abort() {
+    if (finished) return;
+    finished = true;
+
+    buffer.clear();
+    buffer.shrink_to_fit();
+    remove_runs();
+
+    // No index entry points past the start, the records appended since can go
+    store.pending_block.resize(start_pending_block);
+    store.data_out.close();
+    std::error_code ec;
+    std::filesystem::resize_file(store.data_file, start_data_end, ec);
+    if (ec) {
+        std::cerr << "STORAGE: Could not truncate [" << store.data_file << "]: " << ec.message() << std::endl;
     }
-    index_out.flush();
+    store.data_out.open(store.data_file, std::ios::binary | std::ios::out | std::ios::app);
+    store.data_end = start_data_end;
+    appended = 0;
+}
 
+void ISAMStorage::BulkWriter::remove_runs() {
+    for (const auto& run_file : run_files) {
+        std::error_code ec;
+        std::filesystem::remove(run_file, ec);
+    }
+    run_files.clear();
+}
+
+void ISAMStorage::BulkWriter::append(uint64_t key, std::string_view bytes) {
+    if (finished) {
+        std::cerr << "STORAGE: append() called on a finished bulk writer, record dropped." << std::endl;
+        return;
+    }
+
+    buffer.emplace_back(key, store.append_record(bytes));
+    appended++;
+
+    if (buffer.size() >= max_buffered) {
+        spill();
+    }
 }
 
-std::optional<std::pair<uint64_t, std::string > > ISAMStorage::next() {
-    if (index_ptr >= loaded_indexes.size()) {
+// Sorts the buffered entries and writes them out as a run file
+void ISAMStorage::BulkWriter::spill() {
+    sort_and_deduplicate(buffer);
+
+    std::string run_file = store.index_file + ".run" + std::to_string(run_files.size());
+    std::ofstream run_out(run_file, std::ios::binary | std::ios::out | std::ios::trunc);
+    for (const auto& entry : buffer) {
+        run_out.write(reinterpret_cast<const char*>(&entry.first), sizeof(uint64_t));
+        run_out.write(reinterpret_cast<const char*>(&entry.second), sizeof(uint64_t));
+    }
+
+    run_files.push_back(run_file);
+    buffer.clear();
+}
+
+// K-way merge of the sorted run files straight into out, a key found in several runs keeps the entry
+// from the newest one. Every key written is added to filter if there is one. Returns the entry count
+uint64_t ISAMStorage::BulkWriter::merge_runs(std::ofstream& out, BloomFilter* filter) {
+    std::vector<std::ifstream> runs;
+    std::vector<std::pair<uint64_t, uint64_t> > current(run_files.size());
+    for (const auto& run_file : run_files) {
+        runs.emplace_back(run_file, std::ios::binary | std::ios::in);
+    }
+
+    auto advance = [&](size_t run) {
+        runs[run].read(reinterpret_cast<char*>(&current[run].first), sizeof(uint64_t));
+        runs[run].read(reinterpret_cast<char*>(&current[run].second), sizeof(uint64_t));
+        return static_cast<bool>(runs[run]);
+    };
+
+    // Ordered by (key, run), so equal keys come out oldest run first
+    using head_t = std::pair<uint64_t, size_t>;
+    std::priority_queue<head_t, std::vector<head_t>, std::greater<head_t> > heads;
+    for (size_t run = 0; run < runs.size(); run++) {
+        if (advance(run)) heads.emplace(current[run].first, run);
+    }
+
+    // An entry is held back until the next key differs, a newer run may still replace it
+    uint64_t written = 0;
+    std::pair<uint64_t, uint64_t> pending;
+    bool has_pending = false;
+    auto write_pending = [&]() {
+        out.write(reinterpret_cast<const char*>(&pending.first), sizeof(uint64_t));
+        out.write(reinterpret_cast<const char*>(&pending.second), sizeof(uint64_t));
+        if (filter != nullptr) filter->add(pending.first);
+        written++;
+    };
+
+    while (!heads.empty()) {
+        size_t run = heads.top().second;
+        heads.pop();
+
+        if (has_pending && pending.first != current[run].first) write_pending();
+        pending = current[run];
+        has_pending = true;
+
+        if (advance(run)) heads.emplace(current[run].first, run);
+    }
+    if (has_pending) write_pending();
+
+    runs.clear();
+    remove_runs();
+
+    return written;
+}
+
+void ISAMStorage::BulkWriter::finish() {
+    if (finished) return;
+    finished = true;
+
+    store.data_out.flush();
+    if (appended == 0) return;
+
+    // Everything still fits in the budget, commit it like a write()
+    if (run_files.empty()) {
+        sort_and_deduplicate(buffer);
+        store.commit_segment(buffer);
+        buffer.clear();
+        buffer.shrink_to_fit();
+        return;
+    }
+
+    if (!buffer.empty()) spill();
+    buffer.shrink_to_fit();
+
+    // The filter can follow the merge if it only needs the new keys, which is also the case for an empty store
+    bool filter_from_merge = store.filters.is_loaded() || store.size() == 0;
+    uint32_t bits_per_key = store.filter_bits_per_key();
+    std::optional<BloomFilter> filter;
+    if (bits_per_key > 0 && filter_from_merge) filter.emplace(appended, bits_per_key);
+
+    store.begin_segment(false);
+
+    // The header goes out with a count no segment can have, so a crash mid-merge leaves a segment the
+    // loader recognises as torn. The real count is patched in once every entry is written
+    store.index_out.flush();
+    std::error_code ec;
+    uint64_t segment_start = std::filesystem::file_size(store.index_file, ec);
+    if (ec) segment_start = 0;
+    uint64_t header[2] = {SEGMENT_MAGIC, UINT64_MAX};
+    store.index_out.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    uint64_t count = merge_runs(store.index_out, filter ? &*filter : nullptr);
+    store.index_out.flush();
+    {
+        std::fstream patch(store.index_file, std::ios::binary | std::ios::in | std::ios::out);
+        patch.seekp(segment_start + sizeof(uint64_t));
+        patch.write(reinterpret_cast<const char*>(&count), sizeof(uint64_t));
+        if (!patch) {
+            std::cerr << "STORAGE: Could not finish the index segment of [" << store.index_file << "]" << std::endl;
+        }
+    }
+
+    // The store loads its index the way it does on open, only the top level with a sparse index
+    store.sparse_index.close();
+    store.sparse = false;
+    store.loaded_indexes.assign({});
+    store.index_loaded = false;
+    store.load_index_file();
+
+    if (filter) {
+        store.store_filter(std::move(*filter), store.filters.is_loaded());
+    } else {
+        // Filters switched off, or the whole filter has to be rebuilt. A store that was not empty now
+        // has at least two segments, so its full index is loaded
+        store.update_filters({});
+    }
+    store.reopen_data();
+}
+
+std::optional<std::string_view> ISAMStorage::read_record(uint64_t offset, std::string& scratch) const {
+    if (compressed) {
+        auto block = read_block(offset >> BLOCK_OFFSET_BITS);
+        auto record = block ? record_in_block(*block, offset & BLOCK_OFFSET_MASK) : std::nullopt;
+        if (!record.has_value()) {
+            return std::nullopt;
+        }
+
+        // The block may be shared through the cache, only the record is copied out
+        scratch.assign(record->data(), record->size());
+        return std::string_view(scratch);
+    }
+
+    if (dictionary_compressed) {
+        thread_local std::string packed;
+        auto raw = read_raw_record(offset, packed);
+        if (!raw.has_value() || !dictionary || !dictionary->decompress(*raw, scratch)) {
+            return std::nullopt;
+        }
+        return std::string_view(scratch);
+    }
+
+    return read_raw_record(offset, scratch);
+}
+
+std::optional<std::string_view> ISAMStorage::read_raw_record(uint64_t offset, std::string& scratch) const {
+    uint32_t len;
+
+    if (options.use_mmap) {
+        // Bounds check against the mapping, a corrupt offset must not read past the end
+        if (offset + sizeof(uint32_t) > data_map.size()) {
+            return std::nullopt;
+        }
+        std::memcpy(&len, data_map.data() + offset, sizeof(uint32_t));
+
+        if (offset + sizeof(uint32_t) + len > data_map.size()) {
+            return std::nullopt;
+        }
+        return std::string_view(data_map.data() + offset + sizeof(uint32_t), len);
+    }
+
+    BlockCache* cache = options.block_cache.get();
+    if (cache != nullptr) {
+        if (auto block = cache->get(data_file_id, offset)) {
+            scratch.assign(*block);
+            return std::string_view(scratch);
+        }
+    }
+
+    // Read length, then the data that follows it
+    if (!data_in.is_open() || !data_in.read_at(offset, reinterpret_cast<char*>(&len), sizeof(uint32_t))) {
+        return std::nullopt;
+    }
+
+    scratch.resize(len);
+    if (!data_in.read_at(offset + sizeof(uint32_t), &scratch[0], len)) {
+        return std::nullopt;
+    }
+
+    if (cache != nullptr) {
+        cache->record_read(sizeof(uint32_t) + len);
+        cache->put(data_file_id, offset, std::make_shared<const std::string>(scratch));
+    }
+
+    return std::string_view(scratch);
+}
+
+std::optional<std::string> ISAMStorage::decode_record(std::string raw) const {
+    if (!dictionary_compressed) {
+        return raw;
+    }
+
+    std::string record;
+    if (!dictionary || !dictionary->decompress(raw, record)) {
         return std::nullopt;
     }
+    return record;
+}
+
+BlockCache::block_t ISAMStorage::read_block(uint64_t block_offset) const {
+    BlockCache* cache = options.block_cache.get();
+    if (cache != nullptr) {
+        if (auto block = cache->get(data_file_id, block_offset)) return block;
+    }
 
-    std::pair<uint64_t, uint64_t > current_index = loaded_indexes[index_ptr++];
+    uint32_t header[2];
+    const char* packed;
+    std::string buffer;
 
-    // Get the data, using offset (TODO: change data type of offset to long long)
-    data_in.seekg((long long)current_index.second);
+    if (options.use_mmap) {
+        if (block_offset + BLOCK_HEADER_SIZE > data_map.size()) {
+            return nullptr;
+        }
+        std::memcpy(header, data_map.data() + block_offset, BLOCK_HEADER_SIZE);
 
-    // Read length
+        if (block_offset + BLOCK_HEADER_SIZE + header[0] > data_map.size()) {
+            return nullptr;
+        }
+        packed = data_map.data() + block_offset + BLOCK_HEADER_SIZE;
+    } else {
+        if (!data_in.is_open() || !data_in.read_at(block_offset, reinterpret_cast<char*>(header), BLOCK_HEADER_SIZE)) {
+            return nullptr;
+        }
+        if (block_offset + BLOCK_HEADER_SIZE + header[0] > data_end) {
+            return nullptr;
+        }
+
+        buffer.resize(header[0]);
+        if (!data_in.read_at(block_offset + BLOCK_HEADER_SIZE, &buffer[0], header[0])) {
+            return nullptr;
+        }
+        packed = buffer.data();
+    }
+
+    // LZ4 expands at most 255 times, a larger size is a corrupt header and must not become a huge allocation
+    if (header[1] > static_cast<uint64_t>(header[0]) * 255 + 16) {
+        return nullptr;
+    }
+
+    auto block = std::make_shared<std::string>(header[1], '\0');
+    if (LZ4_decompress_safe(packed, &(*block)[0], header[0], header[1]) != static_cast<int>(header[1])) {
+        std::cerr << "STORAGE: Corrupt block at offset " << block_offset << " in [" << data_file << "]" << std::endl;
+        return nullptr;
+    }
+
+    if (cache != nullptr) {
+        cache->record_read(BLOCK_HEADER_SIZE + header[0]);
+        cache->put(data_file_id, block_offset, block);
+    }
+    return block;
+}
+
+std::optional<std::string_view> ISAMStorage::record_in_block(const std::string& block, uint64_t offset_in_block) {
     uint32_t len;
-    data_in.read(reinterpret_cast<char*>(&len), sizeof(uint32_t));
+    if (offset_in_block + sizeof(uint32_t) > block.size()) {
+        return std::nullopt;
+    }
+    std::memcpy(&len, block.data() + offset_in_block, sizeof(uint32_t));
+
+    if (offset_in_block + sizeof(uint32_t) + len > block.size()) {
+        return std::nullopt;
+    }
+    return std::string_view(block.data() + offset_in_block + sizeof(uint32_t), len);
+}
 
-    std::string data(len, '\0');
-    data_in.read(reinterpret_cast<char*>(&data[0]), len);
+ISAMStorage::Cursor ISAMStorage::cursor() const {
+    return Cursor(*this, 0, size());
+}
 
-    return std::make_pair(current_index.first, data);
+ISAMStorage::Cursor ISAMStorage::scan(uint64_t lower, uint64_t upper) const {
+    if (lower > upper) {
+        return Cursor(*this, 0, 0);
+    }
 
+    size_t start = lower_bound_position(lower);
+    size_t end = upper == UINT64_MAX ? size() : lower_bound_position(upper + 1);
+    return Cursor(*this, start, end);
 }
 
+ISAMStorage::Cursor ISAMStorage::scan(KeyRange range) const {
+    return scan(range.lower, range.upper);
+}
 
-std::optional<std::pair<uint64_t, std::string > > ISAMStorage::read(uint64_t key) {
+ISAMStorage::Cursor ISAMStorage::scan_prefix(KeyType key_type) const {
+    return scan(CompoundKey::range(key_type));
+}
 
-    // Find the index, std::lower_bound uses binary search
-    auto it = std::lower_bound(loaded_indexes.begin(), loaded_indexes.end(), key,
-           [](const std::pair<uint64_t, uint64_t>& element, const uint64_t& target) {
-               return element.first < target;
-           });
+ISAMStorage::Cursor ISAMStorage::scan_prefix(KeyType key_type, SiteID site_id) const {
+    return scan(CompoundKey::range(key_type, site_id));
+}
 
-    // If there is a match, read the data and return
-    if (it != loaded_indexes.end() && it->first == key) {
-        uint64_t offset = it->second;
-        data_in.seekg(offset);
+std::optional<std::pair<uint64_t, std::string_view > > ISAMStorage::Cursor::next() {
+    if (position >= end) {
+        return std::nullopt;
+    }
+
+    uint64_t key;
+    uint64_t offset;
+    if (store->sparse) {
+        if (position < page_start || position >= page_start + page.size()) {
+            store->sparse_index.read_entries(position, end - position, page);
+            page_start = position;
+            if (page.empty()) return std::nullopt;
+        }
+        key = page[position - page_start].first;
+        offset = page[position - page_start].second;
+    } else {
+        key = store->loaded_indexes.key_at(position);
+        offset = store->loaded_indexes.offset_at(position);
+    }
+    position++;
+
+    if (store->compressed) {
+        uint64_t offset_block = offset >> BLOCK_OFFSET_BITS;
+        if (!block || offset_block != block_offset) {
+            block = store->read_block(offset_block);
+            block_offset = offset_block;
+        }
+
+        auto data = block ? record_in_block(*block, offset & BLOCK_OFFSET_MASK) : std::nullopt;
+        if (!data.has_value()) {
+            return std::nullopt;
+        }
+        return std::make_pair(key, *data);
+    }
 
-        uint32_t len;
-        data_in.read(reinterpret_cast<char*>(&len), sizeof(uint32_t));
+    auto data = store->read_record(offset, scratch);
+    if (!data.has_value()) {
+        return std::nullopt;
+    }
+
+    return std::make_pair(key, *data);
+}
+
+std::optional<std::pair<uint64_t, std::string_view > > ISAMStorage::read_view(uint64_t key, std::string& scratch) const {
 
-        std::string data(len, '\0');
-        data_in.read(&data[0], len);
+    // Find the index, the search structure depends on the lookup layout
+    auto offset = find_offset(key);
 
-        return std::make_pair(key, data);
+    // If there is a match, read the data and return
+    if (offset.has_value()) {
+        auto data = read_record(*offset, scratch);
+        if (!data.has_value()) {
+            return std::nullopt;
+        }
+
+        return std::make_pair(key, *data);
     }
 
     return std::nullopt;
 }
 
-void ISAMStorage::reset_iterator() {
-    index_ptr = 0;
+std::optional<std::pair<uint64_t, std::string > > ISAMStorage::read(uint64_t key) const {
+    std::string scratch;
+    auto entry = read_view(key, scratch);
+    if (!entry.has_value()) {
+        return std::nullopt;
+    }
+
+    // A record that already sits in scratch (stream mode, compressed stores) is moved out
+    if (entry->second.data() == scratch.data()) {
+        return std::make_pair(entry->first, std::move(scratch));
+    }
+    return std::make_pair(entry->first, std::string(entry->second));
+}
+
+std::optional<std::string_view> ISAMStorage::read_slice(uint64_t key, uint64_t pos, size_t length,
+                                                        std::string& scratch) const {
+    auto offset = find_offset(key);
+    if (!offset.has_value()) {
+        return std::nullopt;
+    }
+
+    if (!supports_partial_reads()) {
+        auto record = read_record(*offset, scratch);
+        if (!record.has_value()) {
+            return std::nullopt;
+        }
+        return record->substr(std::min<uint64_t>(pos, record->size()), length);
+    }
+
+    uint32_t len;
+    if (options.use_mmap) {
+        if (*offset + sizeof(uint32_t) > data_map.size()) {
+            return std::nullopt;
+        }
+        std::memcpy(&len, data_map.data() + *offset, sizeof(uint32_t));
+
+        if (*offset + sizeof(uint32_t) + len > data_map.size()) {
+            return std::nullopt;
+        }
+        std::string_view record(data_map.data() + *offset + sizeof(uint32_t), len);
+        return record.substr(std::min<uint64_t>(pos, len), length);
+    }
+
+    BlockCache* cache = options.block_cache.get();
+    if (cache != nullptr) {
+        if (auto record = cache->get(data_file_id, *offset)) {
+            scratch.assign(std::string_view(*record).substr(std::min<uint64_t>(pos, record->size()), length));
+            return std::string_view(scratch);
+        }
+    }
+
+    if (!data_in.is_open() || *offset + sizeof(uint32_t) > data_end) {
+        return std::nullopt;
+    }
+
+    // A slice at the start of the record comes in with its length prefix in one read
+    if (pos == 0) {
+        // Clamped before the prefix is added, a length of SIZE_MAX ("the rest") must not wrap around
+        uint64_t available = std::min<uint64_t>(length, data_end - *offset - sizeof(uint32_t)) + sizeof(uint32_t);
+        if (available < sizeof(uint32_t)) {
+            return std::nullopt;
+        }
+        scratch.resize(available);
+        if (!data_in.read_at(*offset, &scratch[0], available)) {
+            return std::nullopt;
+        }
+        std::memcpy(&len, scratch.data(), sizeof(uint32_t));
+        if (cache != nullptr) {
+            cache->record_read(available);
+        }
+
+        scratch.erase(0, sizeof(uint32_t));
+        if (scratch.size() > len) scratch.resize(len);
+        return std::string_view(scratch);
+    }
+
+    if (!data_in.read_at(*offset, reinterpret_cast<char*>(&len), sizeof(uint32_t))) {
+        return std::nullopt;
+    }
+    uint64_t start = std::min<uint64_t>(pos, len);
+    size_t bytes = std::min<uint64_t>(length, len - start);
+
+    scratch.resize(bytes);
+    if (bytes > 0 && !data_in.read_at(*offset + sizeof(uint32_t) + start, &scratch[0], bytes)) {
+        return std::nullopt;
+    }
+    if (cache != nullptr) {
+        cache->record_read(sizeof(uint32_t) + bytes);
+    }
+    return std::string_view(scratch);
+}
+
+std::vector<std::optional<std::pair<uint64_t, std::string > > > ISAMStorage::read_many(const std::vector<uint64_t>& keys,
+                                                                                      int threads) const {
+    return read_many(keys.data(), keys.size(), threads);
+}
+
+std::vector<std::optional<std::pair<uint64_t, std::string > > > ISAMStorage::read_many(const uint64_t* keys, size_t count,
+                                                                                      int threads) const {
+    std::vector<std::optional<std::pair<uint64_t, std::string > > > results(count);
+
+    // Resolve every key first, (offset, position in keys)
+    std::vector<std::pair<uint64_t, size_t> > fetches;
+    fetches.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        auto offset = find_offset(keys[i]);
+        if (offset.has_value()) fetches.emplace_back(*offset, i);
+    }
+
+    // Visit the data file front to back
+    std::sort(fetches.begin(), fetches.end());
+
+    // Runs the ranges ([first, last) into fetches) on up to threads workers,
+    // every range writes to its own result slots so workers need no synchronisation
+    auto for_each_range = [&](const std::vector<std::pair<size_t, size_t> >& ranges, const auto& read_range) {
+        size_t workers = std::min<size_t>(std::max(threads, 1), ranges.size());
+        if (workers <= 1) {
+            for (const auto& range : ranges) read_range(range);
+            return;
+        }
+
+        std::vector<std::thread> pool;
+        for (size_t w = 0; w < workers; w++) {
+            pool.emplace_back([&, w]() {
+                for (size_t r = w; r < ranges.size(); r += workers) read_range(ranges[r]);
+            });
+        }
+        for (auto& t : pool) t.join();
+    };
+
+    if (compressed) {
+        // After the sort the records of one block are next to each other, each block is decompressed once
+        std::vector<std::pair<size_t, size_t> > blocks;
+        for (size_t i = 0; i < fetches.size(); i++) {
+            if (blocks.empty() || (fetches[i].first >> BLOCK_OFFSET_BITS) != (fetches[i - 1].first >> BLOCK_OFFSET_BITS)) {
+                blocks.emplace_back(i, i + 1);
+            } else {
+                blocks.back().second = i + 1;
+            }
+        }
+
+        for_each_range(blocks, [&](const std::pair<size_t, size_t>& range) {
+            auto block = read_block(fetches[range.first].first >> BLOCK_OFFSET_BITS);
+            if (!block) return;
+
+            for (size_t i = range.first; i < range.second; i++) {
+                auto data = record_in_block(*block, fetches[i].first & BLOCK_OFFSET_MASK);
+                size_t position = fetches[i].second;
+                if (data.has_value()) results[position] = std::make_pair(keys[position], std::string(*data));
+            }
+        });
+        return results;
+    }
+
+    if (options.use_mmap) {
+        for (const auto& fetch : fetches) {
+            std::string scratch;
+            auto data = read_record(fetch.first, scratch);
+            if (data.has_value()) results[fetch.second] = std::make_pair(keys[fetch.second], std::string(*data));
+        }
+        return results;
+    }
+
+    // Serve what the cache holds, only the rest goes to disk
+    BlockCache* cache = options.block_cache.get();
+    if (cache != nullptr) {
+        size_t out = 0;
+        for (const auto& fetch : fetches) {
+            if (auto block = cache->get(data_file_id, fetch.first)) {
+                if (auto record = decode_record(*block)) {
+                    results[fetch.second] = std::make_pair(keys[fetch.second], std::move(*record));
+                }
+            } else {
+                fetches[out++] = fetch;
+            }
+        }
+        fetches.resize(out);
+    }
+
+    // Group neighbouring fetches into ranges, [first, last) into fetches
+    std::vector<std::pair<size_t, size_t> > ranges;
+    for (size_t i = 0; i < fetches.size(); i++) {
+        if (ranges.empty() || fetches[i].first - fetches[i - 1].first > READ_MERGE_GAP) {
+            ranges.emplace_back(i, i + 1);
+        } else {
+            ranges.back().second = i + 1;
+        }
+    }
+
+    for_each_range(ranges, [&](const std::pair<size_t, size_t>& range) {
+        uint64_t start = fetches[range.first].first;
+        uint64_t end = fetches[range.second - 1].first + READ_AHEAD;
+
+        // The last range may run into the end of the file, read what is there
+        uint64_t available = data_end > start ? std::min<uint64_t>(end, data_end) - start : 0;
+        std::string window(available, '\0');
+        if (available == 0 || !data_in.read_at(start, &window[0], available)) return;
+        if (cache != nullptr) {
+            cache->record_read(available);
+        }
+
+        for (size_t i = range.first; i < range.second; i++) {
+            uint64_t relative = fetches[i].first - start;
+            size_t position = fetches[i].second;
+
+            uint32_t len;
+            if (relative + sizeof(uint32_t) <= window.size()) {
+                std::memcpy(&len, window.data() + relative, sizeof(uint32_t));
+            } else if (!data_in.read_at(fetches[i].first, reinterpret_cast<char*>(&len), sizeof(uint32_t))) {
+                continue;
+            }
+
+            // A corrupt length must not turn into a huge allocation
+            if (fetches[i].first + sizeof(uint32_t) + len > data_end) continue;
+
+            std::string data(len, '\0');
+            uint64_t in_window = relative + sizeof(uint32_t) < window.size()
+                                     ? std::min<uint64_t>(len, window.size() - relative - sizeof(uint32_t))
+                                     : 0;
+            if (in_window > 0) {
+                std::memcpy(&data[0], window.data() + relative + sizeof(uint32_t), in_window);
+            }
+
+            // Records larger than the read-ahead need their tail fetched separately
+            if (in_window < len) {
+                if (!data_in.read_at(fetches[i].first + sizeof(uint32_t) + in_window, &data[in_window], len - in_window)) {
+                    continue;
+                }
+                if (cache != nullptr) cache->record_read(len - in_window);
+            }
+
+            if (cache != nullptr) cache->put(data_file_id, fetches[i].first, std::make_shared<const std::string>(data));
+
+            if (auto record = decode_record(std::move(data))) {
+                results[position] = std::make_pair(keys[position], std::move(*record));
+            }
+        }
+    });
+
+    return results;
+}
+
+// Files used while compacting, the marker exists only while the new files are being renamed into place
+static std::string compact_path(const std::string& file) {
+    return file + ".compact";
 }
 
+static std::string commit_marker_path(const std::string& index_file) {
+    return index_file + ".compact.commit";
+}
 
+void ISAMStorage::recover_compaction(const std::string& index_file, const std::string& data_file) {
+    std::error_code ec;
+    std::string marker = commit_marker_path(index_file);
 
+    if (std::filesystem::exists(marker, ec)) {
+        // Both new files were complete before the marker was written, finish the swap
+        if (std::filesystem::exists(compact_path(data_file), ec)) {
+            std::filesystem::rename(compact_path(data_file), data_file, ec);
+        }
+        if (std::filesystem::exists(RecordDictionary::file_path(compact_path(data_file)), ec)) {
+            std::filesystem::rename(RecordDictionary::file_path(compact_path(data_file)), RecordDictionary::file_path(data_file), ec);
+        }
+        if (std::filesystem::exists(compact_path(index_file), ec)) {
+            std::filesystem::rename(compact_path(index_file), index_file, ec);
+        }
+        if (std::filesystem::exists(BloomFilter::file_path(compact_path(index_file)), ec)) {
+            std::filesystem::rename(BloomFilter::file_path(compact_path(index_file)), BloomFilter::file_path(index_file), ec);
+        }
+        std::filesystem::remove(SparseKeyIndex::top_file_path(index_file), ec);
+        std::filesystem::remove(marker, ec);
+        std::cout << "STORAGE: Completed interrupted compaction of [" << index_file << "]" << std::endl;
+        return;
+    }
 
+    // Without a marker the originals are untouched, leftovers of an unfinished compaction are dropped
+    std::filesystem::remove(compact_path(index_file), ec);
+    std::filesystem::remove(compact_path(data_file), ec);
+    std::filesystem::remove(BloomFilter::file_path(compact_path(index_file)), ec);
+    std::filesystem::remove(RecordDictionary::file_path(compact_path(data_file)), ec);
+}
+
+bool ISAMStorage::compact(const std::string& index_file, const std::string& data_file) {
+    recover_compaction(index_file, data_file);
+
+    std::error_code ec;
+    if (!std::filesystem::exists(index_file, ec) || !std::filesystem::exists(data_file, ec)) {
+        std::cerr << "STORAGE: Nothing to compact, [" << index_file << "] or [" << data_file << "] is missing." << std::endl;
+        return false;
+    }
+
+    uintmax_t old_size = std::filesystem::file_size(index_file, ec) + std::filesystem::file_size(data_file, ec);
+    uint64_t records = 0;
+    uint64_t expected = 0;
+
+    {
+        ISAMStorage source(index_file, data_file);
+
+        // The compacted store keeps the data format of the original, and a filter if it had a current one
+        ISAMOptions target_options;
+        target_options.bloom_bits_per_key = source.filters.get_bits_per_key();
+        if (source.compressed) {
+            target_options.compression = ISAMOptions::Compression::LZ4;
+            target_options.compression_block_size = source.block_size;
+        }
+        ISAMStorage target(compact_path(index_file), compact_path(data_file), target_options);
+        if (source.dictionary_compressed && source.dictionary) {
+            target.set_dictionary(source.dictionary);
+        }
+
+        // The cursor walks in key order, so the new data file is written in key order too
+        auto writer = target.bulk_writer();
+        auto cursor = source.cursor();
+        while (auto entry = cursor.next()) {
+            writer.append(entry->first, entry->second);
+        }
+        writer.finish();
+        records = writer.count();
+        expected = source.size();
+    }
+
+    if (records != expected) {
+        std::cerr << "STORAGE: Compaction of [" << index_file << "] stopped at an unreadable record, "
+                  << "original files kept." << std::endl;
+        recover_compaction(index_file, data_file);
+        return false;
+    }
+
+    std::string compacted_bloom = BloomFilter::file_path(compact_path(index_file));
+    bool has_filter = std::filesystem::exists(compacted_bloom, ec);
+    std::string compacted_dict = RecordDictionary::file_path(compact_path(data_file));
+    bool has_dict = std::filesystem::exists(compacted_dict, ec);
+
+    // Make sure the new files are on disk before anything points at them
+    if (!RandomAccessFile::sync_file(compact_path(data_file)) || !RandomAccessFile::sync_file(compact_path(index_file)) ||
+        (has_filter && !RandomAccessFile::sync_file(compacted_bloom)) ||
+        (has_dict && !RandomAccessFile::sync_file(compacted_dict))) {
+        std::cerr << "STORAGE: Could not sync compacted files, original files kept." << std::endl;
+        recover_compaction(index_file, data_file);
+        return false;
+    }
+
+    // Without a replacement the old filter must not outlive the swap
+    if (!has_filter) {
+        std::filesystem::remove(BloomFilter::file_path(index_file), ec);
+    }
+
+    std::string marker = commit_marker_path(index_file);
+    std::ofstream(marker, std::ios::out | std::ios::trunc).close();
+    RandomAccessFile::sync_file(marker);
 
+    std::filesystem::rename(compact_path(data_file), data_file, ec);
+    if (!ec && has_dict) std::filesystem::rename(compacted_dict, RecordDictionary::file_path(data_file), ec);
+    if (!ec) std::filesystem::rename(compact_path(index_file), index_file, ec);
+    if (!ec && has_filter) std::filesystem::rename(compacted_bloom, BloomFilter::file_path(index_file), ec);
+    if (ec) {
+        // The marker stays, the next open rolls the swap forward
+        std::cerr << "STORAGE: Swapping in compacted files failed: " << ec.message() << std::endl;
+        return false;
+    }
+    std::filesystem::remove(SparseKeyIndex::top_file_path(index_file), ec);
+    std::filesystem::remove(marker, ec);
+
+    uintmax_t new_size = std::filesystem::file_size(index_file, ec) + std::filesystem::file_size(data_file, ec);
+    std::cout << "STORAGE: Compacted [" << index_file << "], " << records << " records, "
+              << old_size << " -> " << new_size << " bytes." << std::endl;
+    return true;
+}
@@ -0,0 +1,381 @@
+#include "key_index.hpp"
+#include "isam_storage.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+void KeyIndex::assign(const std::vector<std::pair<uint64_t, uint64_t> >& entries) {
+    keys.resize(entries.size());
+    offsets.resize(entries.size());
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        keys[i] = entries[i].first;
+        offsets[i] = entries[i].second;
+    }
+
+    if (layout == Layout::EYTZINGER) {
+        build_eytzinger();
+    }
+}
+
+std::vector<std::pair<uint64_t, uint64_t> > KeyIndex::entries() const {
+    std::vector<std::pair<uint64_t, uint64_t> > result;
+    result.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        result.emplace_back(keys[i], offsets[i]);
+    }
+    return result;
+}
+
+void KeyIndex::clear() {
+    keys.clear();
+    offsets.clear();
+    eytzinger_keys.clear();
+    eytzinger_offsets.clear();
+    eytzinger_rank.clear();
+}
+
+void KeyIndex::set_layout(Layout new_layout) {
+    layout = new_layout;
+
+    eytzinger_keys.clear();
+    eytzinger_keys.shrink_to_fit();
+    eytzinger_offsets.clear();
+    eytzinger_offsets.shrink_to_fit();
+    eytzinger_rank.clear();
+    eytzinger_rank.shrink_to_fit();
+
+    if (layout == Layout::EYTZINGER) {
+        build_eytzinger();
+    }
+}
+
+// Fills the tree with an in-order walk, which visits the slots in sorted key order
+void KeyIndex::build_eytzinger() {
+    const size_t n = keys.size();
+    eytzinger_keys.assign(n + 1, 0);
+    eytzinger_offsets.assign(n + 1, 0);
+    eytzinger_rank.assign(n + 1, 0);
+
+    size_t next = 0;
+    size_t slot = 1;
+
+    // Iterative in-order traversal, the tree is implicit (children of k are 2k and 2k + 1)
+    std::vector<size_t> stack;
+    while (slot <= n || !stack.empty()) {
+        while (slot <= n) {
+            stack.push_back(slot);
+            slot = 2 * slot;
+        }
+        slot = stack.back();
+        stack.pop_back();
+
+        eytzinger_keys[slot] = keys[next];
+        eytzinger_offsets[slot] = offsets[next];
+        eytzinger_rank[slot] = static_cast<uint32_t>(next);
+        next++;
+
+        slot = 2 * slot + 1;
+    }
+}
+
+size_t KeyIndex::eytzinger_slot(uint64_t key) const {
+    const size_t n = keys.size();
+    const uint64_t* tree = eytzinger_keys.data();
+
+    size_t k = 1;
+    while (k <= n) {
+#if defined(__GNUC__) || defined(__clang__)
+        // 16 levels down from k share one cache line of descendants, fetch it while comparing
+        __builtin_prefetch(tree + 16 * k);
+#endif
+        k = 2 * k + (tree[k] < key);
+    }
+
+    // Undo the trailing right turns, plus the final left turn, to land on the answer
+#if defined(__GNUC__) || defined(__clang__)
+    k >>= __builtin_ffsll(static_cast<long long>(~k));
+#else
+    while (k & 1) k >>= 1;
+    k >>= 1;
+#endif
+
+    return k;
+}
+
+size_t KeyIndex::interpolation_lower_bound(uint64_t key) const {
+    size_t low = 0;
+    size_t high = keys.size();
+
+    // A handful of guesses, skewed key spaces then finish with plain binary search
+    for (int probe = 0; probe < 4 && high - low > 32; probe++) {
+        uint64_t low_key = keys[low];
+        uint64_t high_key = keys[high - 1];
+
+        if (key <= low_key) return low;
+        if (key > high_key) return high;
+
+        // Long double keeps the ratio exact enough for 64-bit keys
+        long double fraction = static_cast<long double>(key - low_key) / static_cast<long double>(high_key - low_key);
+        size_t guess = low + static_cast<size_t>(fraction * static_cast<long double>(high - 1 - low));
+
+        if (keys[guess] < key) {
+            low = guess + 1;
+        } else if (guess == low || keys[guess - 1] < key) {
+            // Exact hit, the neighbour is usually on the same cache line
+            return guess;
+        } else {
+            high = guess;
+        }
+    }
+
+    return std::lower_bound(keys.begin() + low, keys.begin() + high, key) - keys.begin();
+}
+
+size_t KeyIndex::lower_bound(uint64_t key) const {
+    switch (layout) {
+        case Layout::EYTZINGER: {
+            size_t slot = eytzinger_slot(key);
+            return slot == 0 ? keys.size() : eytzinger_rank[slot];
+        }
+        case Layout::INTERPOLATION:
+            return interpolation_lower_bound(key);
+        case Layout::BINARY:
+        default:
+            return std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+    }
+}
+
+std::optional<uint64_t> KeyIndex::find(uint64_t key) const {
+    if (layout == Layout::EYTZINGER) {
+        size_t slot = eytzinger_slot(key);
+        if (slot != 0 && eytzinger_keys[slot] == key) {
+            return eytzinger_offsets[slot];
+        }
+        return std::nullopt;
+    }
+
+    size_t position = lower_bound(key);
+    if (position < keys.size() && keys[position] == key) {
+        return offsets[position];
+    }
+    return std::nullopt;
+}
+
+static constexpr uint64_t SEGMENT_MAGIC = ISAMStorage::SEGMENT_MAGIC;
+static constexpr size_t SEGMENT_HEADER_SIZE = ISAMStorage::SEGMENT_HEADER_SIZE;
+static constexpr size_t ENTRY_SIZE = 2 * sizeof(uint64_t);
+
+static uint64_t load_u64(const char* data) {
+    uint64_t value;
+    std::memcpy(&value, data, sizeof(uint64_t));
+    return value;
+}
+
+bool SparseKeyIndex::open(const std::string& index_file, uint32_t interval, bool use_mmap,
+                          std::shared_ptr<BlockCache> cache) {
+    close();
+    this->interval = std::max<uint32_t>(interval, 1);
+    this->use_mmap = use_mmap;
+    // The mapping is served from the page cache already
+    if (!use_mmap && cache) {
+        this->cache = std::move(cache);
+        index_file_id = BlockCache::file_id(index_file);
+    }
+
+    std::error_code ec;
+    uint64_t index_size = std::filesystem::file_size(index_file, ec);
+    if (ec || index_size < SEGMENT_HEADER_SIZE) return false;
+
+    char header[SEGMENT_HEADER_SIZE];
+    if (use_mmap) {
+        if (!index_map.open(index_file)) return false;
+        std::memcpy(header, index_map.data(), SEGMENT_HEADER_SIZE);
+    } else {
+        if (!index_in.open(index_file) || !index_in.read_at(0, header, SEGMENT_HEADER_SIZE)) {
+            close();
+            return false;
+        }
+    }
+
+    // Exactly one segment, anything else needs the merge of the full loader
+    count = load_u64(header + sizeof(uint64_t));
+    if (load_u64(header) != SEGMENT_MAGIC || index_size != SEGMENT_HEADER_SIZE + count * ENTRY_SIZE) {
+        close();
+        return false;
+    }
+
+    std::string top_file = top_file_path(index_file);
+    if (!load_top_file(top_file, index_size)) {
+        build_top_level();
+        save_top_file(top_file, index_size);
+    }
+    return true;
+}
+
+void SparseKeyIndex::close() {
+    page_keys.clear();
+    page_keys.shrink_to_fit();
+    count = 0;
+    cache.reset();
+    index_file_id = 0;
+    index_map.close();
+    index_in.close();
+}
+
+size_t SparseKeyIndex::page_length(size_t page) const {
+    return std::min<uint64_t>(interval, count - page * interval);
+}
+
+const char* SparseKeyIndex::page_data(size_t page, std::string& buffer, BlockCache::block_t& block) const {
+    uint64_t start = SEGMENT_HEADER_SIZE + page * static_cast<uint64_t>(interval) * ENTRY_SIZE;
+    size_t bytes = page_length(page) * ENTRY_SIZE;
+
+    if (use_mmap) {
+        return index_map.data() + start;
+    }
+
+    if (cache) {
+        block = cache->get(index_file_id, start);
+        if (block) return block->data();
+    }
+
+    buffer.resize(bytes);
+    if (!index_in.read_at(start, &buffer[0], bytes)) {
+        return nullptr;
+    }
+
+    if (cache) {
+        cache->record_read(bytes);
+        cache->put(index_file_id, start, std::make_shared<const std::string>(buffer));
+    }
+    return buffer.data();
+}
+
+// Top file layout: [TOP_MAGIC][interval][entry count][index file size][first key of each page...]
+bool SparseKeyIndex::load_top_file(const std::string& top_file, uint64_t index_size) {
+    std::ifstream top_in(top_file, std::ios::binary | std::ios::in);
+    if (!top_in) return false;
+
+    uint64_t header[4];
+    top_in.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!top_in || header[0] != TOP_MAGIC || header[1] != interval || header[2] != count || header[3] != index_size) {
+        return false;
+    }
+
+    size_t pages = (count + interval - 1) / interval;
+    page_keys.resize(pages);
+    top_in.read(reinterpret_cast<char*>(page_keys.data()), pages * sizeof(uint64_t));
+    if (!top_in) {
+        page_keys.clear();
+        return false;
+    }
+
+    // Cheap guard against a top file left over from a different index of the same size
+    std::string buffer;
+    BlockCache::block_t block;
+    const char* first_page = pages > 0 ? page_data(0, buffer, block) : nullptr;
+    if (pages > 0 && (first_page == nullptr || load_u64(first_page) != page_keys[0])) {
+        page_keys.clear();
+        return false;
+    }
+    return true;
+}
+
+void SparseKeyIndex::build_top_level() {
+    size_t pages = (count + interval - 1) / interval;
+    page_keys.resize(pages);
+
+    for (size_t page = 0; page < pages; page++) {
+        uint64_t start = SEGMENT_HEADER_SIZE + page * static_cast<uint64_t>(interval) * ENTRY_SIZE;
+        if (use_mmap) {
+            page_keys[page] = load_u64(index_map.data() + start);
+        } else {
+            char key[sizeof(uint64_t)];
+            page_keys[page] = index_in.read_at(start, key, sizeof(key)) ? load_u64(key) : UINT64_MAX;
+        }
+    }
+    std::cout << "STORAGE: Built sparse index with " << pages << " pages." << std::endl;
+}
+
+// Best effort, a read-only directory just means the top level is rebuilt on every open
+void SparseKeyIndex::save_top_file(const std::string& top_file, uint64_t index_size) const {
+    std::ofstream top_out(top_file, std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!top_out) return;
+
+    uint64_t header[4] = {TOP_MAGIC, interval, count, index_size};
+    top_out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    top_out.write(reinterpret_cast<const char*>(page_keys.data()), page_keys.size() * sizeof(uint64_t));
+}
+
+// Binary search inside one leaf page of raw entries
+static size_t page_lower_bound(const char* data, size_t length, uint64_t key) {
+    size_t low = 0;
+    size_t high = length;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (load_u64(data + mid * ENTRY_SIZE) < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+size_t SparseKeyIndex::lower_bound(uint64_t key) const {
+    // Last page whose first key is <= key, keys below the first page land at position 0
+    size_t upper = std::upper_bound(page_keys.begin(), page_keys.end(), key) - page_keys.begin();
+    if (upper == 0) return 0;
+    size_t page = upper - 1;
+
+    // One page buffer per thread keeps lookups allocation free without sharing state
+    thread_local std::string buffer;
+    BlockCache::block_t block;
+    const char* data = page_data(page, buffer, block);
+    if (data == nullptr) return count;
+
+    return page * interval + page_lower_bound(data, page_length(page), key);
+}
+
+std::optional<uint64_t> SparseKeyIndex::find(uint64_t key) const {
+    size_t upper = std::upper_bound(page_keys.begin(), page_keys.end(), key) - page_keys.begin();
+    if (upper == 0) return std::nullopt;
+    size_t page = upper - 1;
+
+    thread_local std::string buffer;
+    BlockCache::block_t block;
+    const char* data = page_data(page, buffer, block);
+    if (data == nullptr) return std::nullopt;
+
+    size_t length = page_length(page);
+    size_t position = page_lower_bound(data, length, key);
+    if (position < length && load_u64(data + position * ENTRY_SIZE) == key) {
+        return load_u64(data + position * ENTRY_SIZE + sizeof(uint64_t));
+    }
+    return std::nullopt;
+}
+
+void SparseKeyIndex::read_entries(size_t position, size_t max_entries,
+                                  std::vector<std::pair<uint64_t, uint64_t> >& out) const {
+    out.clear();
+    if (position >= count) return;
+
+    // Stay within the position's page, cursors ask again for the next one
+    size_t page = position / interval;
+    size_t in_page = position % interval;
+    size_t n = std::min(max_entries, page_length(page) - in_page);
+
+    thread_local std::string buffer;
+    BlockCache::block_t block;
+    const char* data = page_data(page, buffer, block);
+    if (data == nullptr) return;
+
+    out.reserve(n);
+    for (size_t i = in_page; i < in_page + n; i++) {
+        out.emplace_back(load_u64(data + i * ENTRY_SIZE), load_u64(data + i * ENTRY_SIZE + sizeof(uint64_t)));
+    }
+}
@@ -1,9 +1,12 @@
 #include "lexicon.hpp"
 
 #include <algorithm>
+#include <cstring>
 #include <filesystem>
 
 #include "pugixml.hpp"
+#include "random_access_file.hpp"
+#include "tokenizer.hpp"
 #include <iostream>
 #include <fstream>
 
@@ -14,22 +17,34 @@ Lexicon::Lexicon() {
     next_id = 1;
 }
 
-uint64_t Lexicon::add_word(std::string word) {
+const std::string& Lexicon::lookup_key(std::string_view word) {
+    thread_local std::string key;
+    key.assign(word);
+    return key;
+}
+
+uint64_t Lexicon::add_word(std::string_view word) {
+    // Empty words are never added, a tag that trims down to nothing is not a word
+    if (word.empty()) return 0;
+    if (is_mapped()) return mapped_word_id(word);
+
+    const std::string& key = lookup_key(word);
 
     // Check if exists before adding
-    if (word_to_id.count(word) > 0) {
-        return word_to_id[word];
+    auto it = word_to_id.find(key);
+    if (it != word_to_id.end()) {
+        return it->second;
     }
 
     // Create hashmap entry and vector entry
-    id_to_word.emplace_back(word);
-    word_to_id.emplace(word, next_id);
+    id_to_word.emplace_back(key);
+    word_to_id.emplace(key, next_id);
 
     return next_id++;
 }
 
-uint64_t Lexicon::size() {
-    return id_to_word.size();
+uint64_t Lexicon::size() const {
+    return is_mapped() ? mapped_words + 1 : id_to_word.size();
 }
 
 
@@ -40,7 +55,9 @@ void Lexicon::add_words(std::vector<std::string> words) {
 }
 
 
-std::string Lexicon::get_word(int word_id) {
+std::string Lexicon::get_word(int word_id) const {
+    if (is_mapped()) return word_id < 1 ? "" : mapped_word(static_cast<uint64_t>(word_id));
+
     // Vector bounds check
     if (word_id < 1 || word_id >= id_to_word.size()) {
         return "";
@@ -48,8 +65,11 @@ std::string Lexicon::get_word(int word_id) {
     return id_to_word[word_id];
 }
 
-uint64_t Lexicon::get_word_id(std::string word) {
-    return word_to_id.count(word) == 0 ? 0 : word_to_id[word];
+uint64_t Lexicon::get_word_id(std::string_view word) const {
+    if (is_mapped()) return mapped_word_id(word);
+
+    auto it = word_to_id.find(lookup_key(word));
+    return it == word_to_id.end() ? 0 : it->second;
 }
 
 // Might need better exception handling/checks
@@ -74,6 +94,7 @@ bool Lexicon::load(std::string file_path) {
         std::cerr << "File " << file_path << " does not exist" << std::endl;
         return false;
     }
+    file.close();
     if (id_to_word.size() > 1) {
         std::cerr << "Lexicon already has data! File " << file_path << "not loaded." << std::endl;
     }
@@ -83,7 +104,13 @@ bool Lexicon::load(std::string file_path) {
     std::string word_buffer;
 
     // Load words into lexicon from file
+    // Older files can hold an empty line, its id stays taken so the ids after it do not shift
     while (getline(lex_file, word_buffer)) {
+        if (word_buffer.empty()) {
+            id_to_word.emplace_back();
+            next_id++;
+            continue;
+        }
         add_word(word_buffer);
     }
 
@@ -91,45 +118,230 @@ bool Lexicon::load(std::string file_path) {
     return true;
 }
 
-std::vector<std::string> Lexicon::tokenize_text(std::string text, char delim) {
-    int last = 0;
+std::vector<std::string> Lexicon::tokenize_text(std::string_view text) {
     std::vector<std::string> tokens;
+    Tokenizer tokenizer(text);
+    while (auto token = tokenizer.next()) {
+        tokens.emplace_back(*token);
+    }
+    return tokens;
+}
+
+std::string Lexicon::normalize_token(std::string_view token) {
+    return std::string(Tokenizer::normalize(token));
+}
+
+//  BINARY FORMAT
+static void append_varint(uint64_t value, std::string& out) {
+    while (value >= 0x80) {
+        out += static_cast<char>(0x80 | (value & 0x7F));
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+// False if the varint runs past end
+static bool read_varint(const char*& pos, const char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; pos < end && shift < 64; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*pos++);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (byte < 0x80) return true;
+    }
+    return false;
+}
+
+// Decodes the next word of a block into word, which holds the word before it. False on damaged data
+static bool read_entry(const char*& pos, const char* end, std::string& word) {
+    uint64_t shared, suffix;
+    if (!read_varint(pos, end, shared) || !read_varint(pos, end, suffix)) return false;
+    if (shared > word.size() || suffix > static_cast<uint64_t>(end - pos)) return false;
+    word.resize(shared);
+    word.append(pos, suffix);
+    pos += suffix;
+    return true;
+}
+
+// Start of every section for a given word and block count, in file order
+struct LexiconOffsets {
+    uint64_t block_offsets;
+    uint64_t rank_ids;
+    uint64_t id_ranks;
+    uint64_t strings;
+};
+
+static LexiconOffsets lexicon_offsets(uint64_t words, uint64_t blocks) {
+    auto align = [](uint64_t pos) { return (pos + 7) & ~uint64_t(7); };
+    LexiconOffsets offsets{};
+    offsets.block_offsets = Lexicon::HEADER_SIZE;
+    offsets.rank_ids = offsets.block_offsets + blocks * sizeof(uint64_t);
+    offsets.id_ranks = align(offsets.rank_ids + words * sizeof(uint32_t));
+    offsets.strings = align(offsets.id_ranks + (words + 1) * sizeof(uint32_t));
+    return offsets;
+}
+
+bool Lexicon::save_binary(const std::string& path) const {
+    if (is_mapped()) {
+        std::cerr << "STORAGE: A mapped lexicon is already saved, " << path << " not written" << std::endl;
+        return false;
+    }
+    uint64_t words = id_to_word.size() - 1;
+    if (words >= UINT32_MAX) {
+        std::cerr << "STORAGE: Too many words for " << path << std::endl;
+        return false;
+    }
+
+    // Ids in word order
+    std::vector<uint32_t> rank_to_id(words);
+    for (uint64_t i = 0; i < words; i++) rank_to_id[i] = static_cast<uint32_t>(i + 1);
+    std::sort(rank_to_id.begin(), rank_to_id.end(),
+              [&](uint32_t a, uint32_t b) { return id_to_word[a] < id_to_word[b]; });
+
+    std::vector<uint32_t> id_to_rank(words + 1, 0);
+    std::vector<uint64_t> offsets;
+    std::string encoded;
+    std::string_view previous;
+    for (uint64_t rank = 0; rank < words; rank++) {
+        const std::string& word = id_to_word[rank_to_id[rank]];
+        id_to_rank[rank_to_id[rank]] = static_cast<uint32_t>(rank);
 
-    // Trim before parsing
-    text = trim(text, ".,().\"'?:;[]&^%$", ".,().\"'?:;[]&^%$");
-    for (int i = 0; i < text.size(); i++) {
-        if (text[i] == delim) {
-            tokens.push_back(normalize_token(
-                text.substr(last, (i + 1) - last)
-            ));
-            last = i + 1;
+        size_t shared = 0;
+        if (rank % BLOCK_SIZE == 0) {
+            offsets.push_back(encoded.size());
+        } else {
+            size_t limit = std::min(previous.size(), word.size());
+            while (shared < limit && previous[shared] == word[shared]) shared++;
         }
+        append_varint(shared, encoded);
+        append_varint(word.size() - shared, encoded);
+        encoded.append(word, shared, std::string::npos);
+        previous = word;
     }
-    // Push whatever remains
-    tokens.push_back(normalize_token(
-        text.substr(last)
-    ));
 
-    return tokens;
+    // Written beside the target and renamed over it, readers never see a half written lexicon
+    LexiconOffsets layout = lexicon_offsets(words, offsets.size());
+    std::string tmp_file = path + ".tmp";
+    {
+        std::ofstream out(tmp_file, std::ios::binary | std::ios::out | std::ios::trunc);
+        uint64_t header[4] = {MAGIC, words, offsets.size(), encoded.size()};
+        const char padding[8] = {};
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+        out.write(reinterpret_cast<const char*>(rank_to_id.data()), words * sizeof(uint32_t));
+        out.write(padding, layout.id_ranks - (layout.rank_ids + words * sizeof(uint32_t)));
+        out.write(reinterpret_cast<const char*>(id_to_rank.data()), (words + 1) * sizeof(uint32_t));
+        out.write(padding, layout.strings - (layout.id_ranks + (words + 1) * sizeof(uint32_t)));
+        out.write(encoded.data(), encoded.size());
+        if (!out) {
+            std::cerr << "STORAGE: Could not write " << tmp_file << std::endl;
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    RandomAccessFile::sync_file(tmp_file);
+    std::filesystem::rename(tmp_file, path, ec);
+    if (ec) {
+        std::cerr << "STORAGE: Could not replace " << path << ": " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
 }
 
-// TODO: Handle symbols properly,
-// problem is that some symbols are meaningful parts of tech terms (e.g C#, .NET, dots in versioning, etc)
-std::string Lexicon::normalize_token(std::string token) {
-    // Trim, remove some less meaningful symbols (workaround for now)
-    token = trim(token, ".,().\"'?:;[]&^%$", ".,().\"'?:;[]&^%$");
+bool Lexicon::open(const std::string& path) {
+    file.close();
+    id_to_word.resize(1);
+    word_to_id.clear();
+    next_id = 1;
 
-    // To lowercase
-    std::transform(token.begin(), token.end(), token.begin(),
-                   [](unsigned char c) { return std::tolower(c); });
+    // A missing file is not an error, callers fall back to the text lexicon
+    if (!std::filesystem::exists(path)) return false;
+    if (!file.open(path)) {
+        std::cerr << "STORAGE: Could not open " << path << std::endl;
+        return false;
+    }
 
-    return token;
+    uint64_t header[4];
+    if (file.size() < HEADER_SIZE) {
+        std::cerr << "STORAGE: " << path << " is not a lexicon" << std::endl;
+        file.close();
+        return false;
+    }
+    std::memcpy(header, file.data(), sizeof(header));
+
+    // Counts that do not match the file size mean a damaged file, guard the overflow first
+    uint64_t words = header[1];
+    uint64_t blocks = header[2];
+    LexiconOffsets offsets = lexicon_offsets(words, blocks);
+    if (header[0] != MAGIC || words >= UINT32_MAX || blocks != (words + BLOCK_SIZE - 1) / BLOCK_SIZE ||
+        header[3] > file.size() || offsets.strings + header[3] != file.size()) {
+        std::cerr << "STORAGE: " << path << " is not a lexicon" << std::endl;
+        file.close();
+        return false;
+    }
+
+    const char* base = file.data();
+    mapped_words = words;
+    block_count = blocks;
+    block_offsets = reinterpret_cast<const uint64_t*>(base + offsets.block_offsets);
+    rank_ids = reinterpret_cast<const uint32_t*>(base + offsets.rank_ids);
+    id_ranks = reinterpret_cast<const uint32_t*>(base + offsets.id_ranks);
+    strings = base + offsets.strings;
+    strings_end = strings + header[3];
+    return true;
+}
+
+std::string_view Lexicon::block_head(uint64_t block) const {
+    const char* pos = strings + std::min<uint64_t>(block_offsets[block], strings_end - strings);
+    uint64_t shared, length;
+    if (!read_varint(pos, strings_end, shared) || !read_varint(pos, strings_end, length) ||
+        length > static_cast<uint64_t>(strings_end - pos)) {
+        return {};
+    }
+    return std::string_view(pos, length);
+}
+
+uint64_t Lexicon::mapped_word_id(std::string_view word) const {
+    if (word.empty()) return 0;
+
+    // Last block starting at or before the word
+    uint64_t low = 0;
+    uint64_t high = block_count;
+    while (low < high) {
+        uint64_t mid = low + (high - low) / 2;
+        if (block_head(mid) <= word) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == 0) return 0;
+    uint64_t block = low - 1;
+
+    // Words of a block are decoded into a reused per-thread buffer
+    thread_local std::string current;
+    current.clear();
+    const char* pos = strings + std::min<uint64_t>(block_offsets[block], strings_end - strings);
+    uint64_t first = block * BLOCK_SIZE;
+    uint64_t last = std::min(first + BLOCK_SIZE, mapped_words);
+    for (uint64_t rank = first; rank < last; rank++) {
+        if (!read_entry(pos, strings_end, current)) return 0;
+        int order = std::string_view(current).compare(word);
+        if (order == 0) return rank_ids[rank];
+        if (order > 0) return 0;
+    }
+    return 0;
 }
 
-// You can specify more characters to be trimmed from left or right as needed
-std::string Lexicon::trim(const std::string &source, std::string remove_left, std::string remove_right) {
-    std::string s(source);
-    s.erase(0, s.find_first_not_of(remove_left + " \n\r\t"));
-    s.erase(s.find_last_not_of(remove_right + " \n\r\t") + 1);
-    return s;
+std::string Lexicon::mapped_word(uint64_t word_id) const {
+    if (word_id > mapped_words) return "";
+    uint64_t rank = id_ranks[word_id];
+    if (rank >= mapped_words) return "";
+
+    std::string word;
+    const char* pos = strings + std::min<uint64_t>(block_offsets[rank / BLOCK_SIZE], strings_end - strings);
+    for (uint64_t i = 0; i <= rank % BLOCK_SIZE; i++) {
+        if (!read_entry(pos, strings_end, word)) return "";
+    }
+    return word;
 }
@@ -0,0 +1,180 @@
+#include "post_store.hpp"
+
+#include <algorithm>
+#include <string_view>
+#include <vector>
+
+#include "binary_record.hpp"
+
+static_assert(static_cast<int>(PostStore::CONTENT_LICENSE) == static_cast<int>(PostView::CONTENT_LICENSE) &&
+              static_cast<int>(PostStore::TAGS) == static_cast<int>(PostView::STRING_FIELD_COUNT),
+              "PostStore::Field has to follow PostView::StringField");
+
+// Slot in the wanted table of string i of a post, every tag shares the TAGS slot
+static size_t field_slot(size_t i) {
+    return std::min(i, static_cast<size_t>(PostStore::TAGS));
+}
+
+// Whole record, for stores and records that cannot be read in pieces
+static std::optional<PostView> read_whole(const ISAMStorage& data_index, uint64_t key, std::string& scratch) {
+    auto record = data_index.read_view(key, scratch);
+    if (!record.has_value()) {
+        return std::nullopt;
+    }
+    if (BinaryRecord::has_magic(record->second, BinaryRecord::POST_MAGIC)) {
+        return PostView::from_binary(record->second);
+    }
+
+    // JSON is converted into scratch, so it has to move out of the way first
+    thread_local std::string json;
+    json.assign(record->second.data(), record->second.size());
+    return PostView::from_record(json, scratch);
+}
+
+// Copy of a whole binary post that holds only the wanted strings, like the record read_fields() rebuilds
+// False if the record is damaged
+static bool project(std::string_view record, const bool* wanted, std::string& out) {
+    if (record.size() < PostView::STRING_TABLE_OFFSET) {
+        return false;
+    }
+    size_t string_count = PostView::STRING_FIELD_COUNT + BinaryRecord::get<uint32_t>(record, PostView::TAG_COUNT_OFFSET);
+    size_t table_end = PostView::STRING_TABLE_OFFSET + string_count * sizeof(uint32_t);
+    if (record.size() < table_end) {
+        return false;
+    }
+
+    out.assign(record.data(), table_end);
+    size_t start = table_end;
+    for (size_t i = 0; i < string_count; i++) {
+        size_t end = BinaryRecord::get<uint32_t>(record, PostView::STRING_TABLE_OFFSET + i * sizeof(uint32_t));
+        if (end < start || end > record.size()) {
+            return false;
+        }
+        if (wanted[field_slot(i)]) {
+            out.append(record.data() + start, end - start);
+        }
+        BinaryRecord::put<uint32_t>(out, PostView::STRING_TABLE_OFFSET + i * sizeof(uint32_t),
+                                    static_cast<uint32_t>(out.size()));
+        start = end;
+    }
+    return true;
+}
+
+std::optional<PostView> PostStore::read_fields(uint64_t key, std::initializer_list<Field> fields,
+                                               std::string& scratch) const {
+    if (!data_index.supports_partial_reads()) {
+        return read_whole(data_index, key, scratch);
+    }
+
+    thread_local std::string head_buffer;
+    auto head = data_index.read_slice(key, 0, HEAD_READ_SIZE, head_buffer);
+    if (!head.has_value()) {
+        return std::nullopt;
+    }
+    if (!BinaryRecord::has_magic(*head, BinaryRecord::POST_MAGIC)) {
+        return read_whole(data_index, key, scratch);
+    }
+    if (head->size() < PostView::STRING_TABLE_OFFSET) {
+        return std::nullopt;
+    }
+
+    size_t string_count = PostView::STRING_FIELD_COUNT + BinaryRecord::get<uint32_t>(*head, PostView::TAG_COUNT_OFFSET);
+    size_t table_end = PostView::STRING_TABLE_OFFSET + string_count * sizeof(uint32_t);
+    if (head->size() < table_end) {
+        // More tags than the first read covered
+        head = data_index.read_slice(key, 0, table_end, head_buffer);
+        if (!head.has_value() || head->size() < table_end) {
+            return std::nullopt;
+        }
+    }
+
+    bool wanted[TAGS + 1] = {};
+    for (Field field : fields) {
+        wanted[field] = true;
+    }
+    auto string_wanted = [&](size_t i) { return wanted[field_slot(i)]; };
+    auto string_start = [&](size_t i) {
+        return i == 0 ? table_end
+                      : BinaryRecord::get<uint32_t>(*head, PostView::STRING_TABLE_OFFSET + (i - 1) * sizeof(uint32_t));
+    };
+    auto string_end = [&](size_t i) {
+        return static_cast<size_t>(BinaryRecord::get<uint32_t>(*head, PostView::STRING_TABLE_OFFSET + i * sizeof(uint32_t)));
+    };
+
+    // Byte ranges still missing after the first read, neighbours close together share a read
+    struct Span {
+        size_t begin;
+        size_t end;
+        std::string buffer;
+        std::string_view bytes;
+    };
+    std::vector<Span> spans;
+    for (size_t i = 0; i < string_count; i++) {
+        size_t start = string_start(i);
+        size_t end = string_end(i);
+        if (end < start) {
+            return std::nullopt;
+        }
+        if (!string_wanted(i) || end == start || end <= head->size()) continue;
+
+        if (!spans.empty() && start <= spans.back().end + MERGE_GAP) {
+            spans.back().end = end;
+        } else {
+            spans.push_back({start, end, {}, {}});
+        }
+    }
+    for (Span& span : spans) {
+        auto bytes = data_index.read_slice(key, span.begin, span.end - span.begin, span.buffer);
+        if (!bytes.has_value() || bytes->size() != span.end - span.begin) {
+            return std::nullopt;
+        }
+        span.bytes = *bytes;
+    }
+
+    // Rebuild a smaller record that holds the requested strings and leaves the others empty
+    scratch.assign(head->data(), table_end);
+    size_t next_span = 0;
+    for (size_t i = 0; i < string_count; i++) {
+        size_t start = string_start(i);
+        size_t end = string_end(i);
+
+        if (string_wanted(i) && end > start) {
+            if (end <= head->size()) {
+                scratch.append(head->data() + start, end - start);
+            } else {
+                while (spans[next_span].end < end) next_span++;
+                scratch.append(spans[next_span].bytes.substr(start - spans[next_span].begin, end - start));
+            }
+        }
+        BinaryRecord::put<uint32_t>(scratch, PostView::STRING_TABLE_OFFSET + i * sizeof(uint32_t),
+                                    static_cast<uint32_t>(scratch.size()));
+    }
+    return PostView::from_binary(scratch);
+}
+
+std::vector<std::optional<PostView> > PostStore::read_fields_many(const std::vector<uint64_t>& keys,
+                                                                  std::initializer_list<Field> fields,
+                                                                  std::vector<std::string>& scratch,
+                                                                  int threads) const {
+    bool wanted[TAGS + 1] = {};
+    for (Field field : fields) {
+        wanted[field] = true;
+    }
+
+    std::vector<std::optional<PostView> > results(keys.size());
+    scratch.resize(keys.size());
+    auto records = data_index.read_many(keys, threads);
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (!records[i].has_value()) continue;
+
+        if (BinaryRecord::has_magic(records[i]->second, BinaryRecord::POST_MAGIC)) {
+            if (project(records[i]->second, wanted, scratch[i])) {
+                results[i] = PostView::from_binary(scratch[i]);
+            }
+        } else {
+            // JSON is converted into scratch[i], the record stays in the result of read_many()
+            results[i] = PostView::from_record(records[i]->second, scratch[i]);
+        }
+    }
+    return results;
+}
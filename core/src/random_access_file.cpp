@@ -0,0 +1,132 @@
+#include "random_access_file.hpp"
+
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+RandomAccessFile::~RandomAccessFile() {
+    close();
+}
+
+RandomAccessFile::RandomAccessFile(RandomAccessFile&& other) noexcept {
+    *this = std::move(other);
+}
+
+#ifdef _WIN32
+
+RandomAccessFile& RandomAccessFile::operator=(RandomAccessFile&& other) noexcept {
+    if (this != &other) {
+        close();
+        handle = std::exchange(other.handle, nullptr);
+    }
+    return *this;
+}
+
+bool RandomAccessFile::open(const std::string& path) {
+    close();
+
+    HANDLE h = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) return false;
+
+    handle = h;
+    return true;
+}
+
+void RandomAccessFile::close() {
+    if (handle != nullptr) {
+        CloseHandle(static_cast<HANDLE>(handle));
+    }
+    handle = nullptr;
+}
+
+bool RandomAccessFile::is_open() const {
+    return handle != nullptr;
+}
+
+bool RandomAccessFile::read_at(uint64_t offset, char* buffer, size_t len) const {
+    while (len > 0) {
+        // The offset travels with each call, the handle's own file pointer is never relied on
+        OVERLAPPED ov {};
+        ov.Offset = static_cast<DWORD>(offset);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+        DWORD chunk = len > 0x40000000 ? 0x40000000 : static_cast<DWORD>(len);
+        DWORD got = 0;
+        if (!ReadFile(static_cast<HANDLE>(handle), buffer, chunk, &got, &ov) || got == 0) {
+            return false;
+        }
+        buffer += got;
+        offset += got;
+        len -= got;
+    }
+    return true;
+}
+
+bool RandomAccessFile::sync_file(const std::string& path) {
+    HANDLE h = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) return false;
+
+    bool ok = FlushFileBuffers(h) != 0;
+    CloseHandle(h);
+    return ok;
+}
+
+#else
+
+RandomAccessFile& RandomAccessFile::operator=(RandomAccessFile&& other) noexcept {
+    if (this != &other) {
+        close();
+        fd = std::exchange(other.fd, -1);
+    }
+    return *this;
+}
+
+bool RandomAccessFile::open(const std::string& path) {
+    close();
+
+    fd = ::open(path.c_str(), O_RDONLY);
+    return fd >= 0;
+}
+
+void RandomAccessFile::close() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+}
+
+bool RandomAccessFile::is_open() const {
+    return fd >= 0;
+}
+
+bool RandomAccessFile::read_at(uint64_t offset, char* buffer, size_t len) const {
+    while (len > 0) {
+        ssize_t got = ::pread(fd, buffer, len, static_cast<off_t>(offset));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+
+        buffer += got;
+        offset += got;
+        len -= got;
+    }
+    return true;
+}
+
+bool RandomAccessFile::sync_file(const std::string& path) {
+    int sync_fd = ::open(path.c_str(), O_RDONLY);
+    if (sync_fd < 0) return false;
+
+    bool ok = ::fsync(sync_fd) == 0;
+    ::close(sync_fd);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,98 @@
+#include "record_dictionary.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <numeric>
+
+#include <zdict.h>
+#include <zstd.h>
+
+RecordDictionary::RecordDictionary(std::string bytes, int level) : bytes(std::move(bytes)) {
+    dict_id = ZDICT_getDictID(this->bytes.data(), this->bytes.size());
+    cdict = ZSTD_createCDict(this->bytes.data(), this->bytes.size(), level);
+    ddict = ZSTD_createDDict(this->bytes.data(), this->bytes.size());
+}
+
+RecordDictionary::~RecordDictionary() {
+    ZSTD_freeCDict(cdict);
+    ZSTD_freeDDict(ddict);
+}
+
+std::shared_ptr<const RecordDictionary> RecordDictionary::train(const std::vector<std::string>& samples,
+                                                                size_t max_size, int level) {
+    // ZDICT takes the samples back to back plus their sizes
+    std::vector<size_t> sizes;
+    sizes.reserve(samples.size());
+    std::string joined;
+    joined.reserve(std::accumulate(samples.begin(), samples.end(), size_t(0),
+                                   [](size_t sum, const std::string& s) { return sum + s.size(); }));
+    for (const auto& sample : samples) {
+        joined += sample;
+        sizes.push_back(sample.size());
+    }
+
+    std::string dict(max_size, '\0');
+    size_t dict_size = ZDICT_trainFromBuffer(&dict[0], dict.size(), joined.data(), sizes.data(), sizes.size());
+    if (ZDICT_isError(dict_size)) {
+        std::cerr << "STORAGE: Could not train a dictionary on " << samples.size() << " samples: "
+                  << ZDICT_getErrorName(dict_size) << std::endl;
+        return nullptr;
+    }
+    dict.resize(dict_size);
+
+    std::shared_ptr<const RecordDictionary> result(new RecordDictionary(std::move(dict), level));
+    if (result->cdict == nullptr || result->ddict == nullptr) return nullptr;
+    return result;
+}
+
+std::shared_ptr<const RecordDictionary> RecordDictionary::load(const std::string& path, int level) {
+    std::ifstream dict_in(path, std::ios::binary | std::ios::in);
+    if (!dict_in) return nullptr;
+    std::string dict((std::istreambuf_iterator<char>(dict_in)), std::istreambuf_iterator<char>());
+
+    std::shared_ptr<const RecordDictionary> result(new RecordDictionary(std::move(dict), level));
+    if (result->dict_id == 0 || result->cdict == nullptr || result->ddict == nullptr) return nullptr;
+    return result;
+}
+
+bool RecordDictionary::save(const std::string& path) const {
+    std::ofstream dict_out(path, std::ios::binary | std::ios::out | std::ios::trunc);
+    dict_out.write(bytes.data(), bytes.size());
+    return static_cast<bool>(dict_out);
+}
+
+// Contexts hold sizeable buffers, one per thread is kept instead of one per call
+struct ZstdContexts {
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+
+    ~ZstdContexts() {
+        ZSTD_freeCCtx(cctx);
+        ZSTD_freeDCtx(dctx);
+    }
+};
+
+static ZstdContexts& thread_contexts() {
+    thread_local ZstdContexts contexts;
+    return contexts;
+}
+
+bool RecordDictionary::compress(std::string_view record, std::string& out) const {
+    out.resize(ZSTD_compressBound(record.size()));
+    size_t packed = ZSTD_compress_usingCDict(thread_contexts().cctx, &out[0], out.size(),
+                                             record.data(), record.size(), cdict);
+    if (ZSTD_isError(packed)) return false;
+    out.resize(packed);
+    return true;
+}
+
+bool RecordDictionary::decompress(std::string_view packed, std::string& out) const {
+    // Frames carry their content size, a frame that doesn't (or lies about it) is rejected
+    unsigned long long size = ZSTD_getFrameContentSize(packed.data(), packed.size());
+    if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN || size > UINT32_MAX) return false;
+
+    out.resize(size);
+    size_t got = ZSTD_decompress_usingDDict(thread_contexts().dctx, &out[0], out.size(),
+                                            packed.data(), packed.size(), ddict);
+    return !ZSTD_isError(got) && got == size;
+}
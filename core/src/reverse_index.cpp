@@ -2,6 +2,7 @@
 #include <iostream>
 #include <sstream>
 #include <algorithm>
+#include <charconv>
 #include <filesystem>
 
 const ReverseIndex::postings_list_t ReverseIndex::EMPTY_POSTINGS_LIST = {};
@@ -12,65 +13,60 @@ ReverseIndex::ReverseIndex(int num_barrels) : num_barrels_(num_barrels) {
 }
 
 // Helper function to parse word IDs and masks from forward index
-static std::vector<std::pair<uint32_t, uint8_t>> parse_word_ids_with_masks(const std::string& data) {
+// Works directly on the record view, no per-segment strings are allocated
+static std::vector<std::pair<uint32_t, uint8_t>> parse_word_ids_with_masks(std::string_view data) {
     std::vector<std::pair<uint32_t, uint8_t>> word_info;
     if (data.empty()) return word_info;
 
-    std::stringstream ss(data);
-    std::string segment;
+    size_t start = 0;
+    while (start < data.size()) {
+        size_t end = data.find(' ', start);
+        if (end == std::string_view::npos) end = data.size();
+
+        std::string_view segment = data.substr(start, end - start);
+        start = end + 1;
 
-    while (std::getline(ss, segment, ' ')) {
         if (segment.empty()) continue;
         size_t comma_pos = segment.find(',');
-        if (comma_pos == std::string::npos) continue;
+        if (comma_pos == std::string_view::npos) continue;
+
+        uint32_t word_id = 0;
+        int mask = 0;
+        auto id_res = std::from_chars(segment.data(), segment.data() + comma_pos, word_id);
+        auto mask_res = std::from_chars(segment.data() + comma_pos + 1, segment.data() + segment.size(), mask);
+        if (id_res.ec != std::errc() || mask_res.ec != std::errc()) continue;
 
-        try {
-            uint32_t word_id = std::stoul(segment.substr(0, comma_pos));
-            uint8_t mask = static_cast<uint8_t>(std::stoi(segment.substr(comma_pos + 1)));
-            word_info.emplace_back(word_id, mask);
-        } catch (...) { continue; }
+        word_info.emplace_back(word_id, static_cast<uint8_t>(mask));
     }
     return word_info;
 }
 
 //  Build Reverse Index 
-bool ReverseIndex::build(ISAMStorage& forward_index, const Lexicon& lexicon) {
+bool ReverseIndex::build(const ISAMStorage& forward_index, const Lexicon& lexicon) {
     std::cout << "Starting reverse index construction with " << num_barrels_ << " barrels..." << std::endl;
     int count = 0;
 
     for (auto& shard : index_shards_) shard.clear();
     all_words_.clear();
+    doc_ids_.clear();
 
-    forward_index.reset_iterator();
+    auto cursor = forward_index.cursor();
     while (true) {
-        auto entry = forward_index.next();
+        auto entry = cursor.next();
         if (!entry.has_value()) break;
 
-        CompoundKey key = CompoundKey::unpack(entry->first);
-        uint32_t doc_id = key.primary_id;
-        std::string word_ids_str = entry->second;
-
-        
-        auto word_info = parse_word_ids_with_masks(word_ids_str);
+        auto word_info = parse_word_ids_with_masks(entry->second);
+        if (!add_document(entry->first, word_info)) continue;
 
         // Only do this if autocomplete is enabled
-Lexicon& lex = const_cast<Lexicon&>(lexicon);  // Remove const to call get_word safely
-
-for (auto word : word_info) {
-    uint32_t word_id = word.first;
-    if (word_id != 0) {
-        //  BARREL LOGIC
-        int barrel_id = word_id % num_barrels_;
-        index_shards_[barrel_id][word_id].push_back({doc_id});
-
-        //  AUTOCOMPLETE LOGIC 
-        std::string w = lex.get_word(word_id);  
-        if(!w.empty()) all_words_.insert(w);
-    }
-}
+        for (auto word : word_info) {
+            if (word.first == 0) continue;
 
+            //  AUTOCOMPLETE LOGIC
+            std::string w = lexicon.get_word(word.first);
+            if (!w.empty()) all_words_.insert(w);
+        }
 
-        
         count++;
         if (count % 1000 == 0) std::cout << "\rProcessed " << count << " forward index entries..." << std::flush;
     }
@@ -84,16 +80,42 @@ for (auto word : word_info) {
     return true;
 }
 
+bool ReverseIndex::add_document(uint64_t key, const std::vector<std::pair<uint32_t, uint8_t>>& words) {
+    // Documents are numbered densely in key order, posting lists stay sorted
+    auto doc_number = doc_ids_.add(key);
+    if (!doc_number.has_value()) return false;
+    uint32_t doc_id = *doc_number;
+
+    for (const auto& word : words) {
+        uint32_t word_id = word.first;
+        if (word_id == 0) continue;
+
+        //  BARREL LOGIC
+        int barrel_id = word_id % num_barrels_;
+        index_shards_[barrel_id][word_id].push_back({doc_id});
+    }
+    return true;
+}
+
 //  Save Barrels 
-void ReverseIndex::save_barrels(const std::string& directory) {
+void ReverseIndex::save_barrels(const std::string& directory, ISAMOptions::Compression compression) {
     std::cout << "Writing " << num_barrels_ << " barrels to disk..." << std::endl;
 
+    if (!doc_ids_.save(DocIdMap::file_path(directory))) {
+        std::cerr << "Could not save the doc id map to " << directory << std::endl;
+    }
+
     for (int i = 0; i < num_barrels_; ++i) {
         std::string idx_path = directory + "/barrel_" + std::to_string(i) + ".idx";
         std::string dat_path = directory + "/barrel_" + std::to_string(i) + ".dat";
-        ISAMStorage barrel_store(idx_path, dat_path);
+        // Queries probe barrels for word ids they may not hold, the filter answers most of those
+        ISAMOptions options;
+        options.bloom_bits_per_key = 10;
+        options.compression = compression;
+
+        ISAMStorage barrel_store(idx_path, dat_path, options);
+        auto writer = barrel_store.bulk_writer();
 
-        std::vector<std::pair<uint64_t, std::string>> data_to_write;
         const auto& current_shard = index_shards_[i];
 
         for (const auto& p : current_shard) {
@@ -103,29 +125,51 @@ void ReverseIndex::save_barrels(const std::string& directory) {
                 ss << p.second[k].doc_id;
                 if (k < p.second.size() - 1) ss << ",";
             }
-            data_to_write.emplace_back(word_id, ss.str());
+            writer.append(word_id, ss.str());
         }
 
-        if (!data_to_write.empty()) barrel_store.write(data_to_write);
+        writer.finish();
     }
 }
 
 //  Search Barrel 
-ReverseIndex::postings_list_t ReverseIndex::search_barrel(const std::string& directory, int barrel_id, int word_id) {
+ReverseIndex::postings_list_t ReverseIndex::search_barrel(const std::string& directory, int barrel_id, int word_id,
+                                                          std::shared_ptr<BlockCache> cache) {
     std::string idx_path = directory + "/barrel_" + std::to_string(barrel_id) + ".idx";
     std::string dat_path = directory + "/barrel_" + std::to_string(barrel_id) + ".dat";
 
     if (!std::filesystem::exists(idx_path) || !std::filesystem::exists(dat_path)) return EMPTY_POSTINGS_LIST;
 
-    ISAMStorage barrel_store(idx_path, dat_path);
-    auto result = barrel_store.read(word_id);
+    // A word that never went into this barrel is ruled out by its filter without opening the store
+    if (!BloomFilterSet::file_may_contain(BloomFilter::file_path(idx_path), std::filesystem::file_size(idx_path), word_id)) {
+        return EMPTY_POSTINGS_LIST;
+    }
+
+    // Barrel keys are dense word ids, interpolation search needs no extra build step.
+    // A compacted barrel only loads its sparse top level, the one leaf page a lookup needs is mapped in.
+    // With a cache the record is read once and served from memory afterwards instead of mapped per query
+    ISAMOptions options;
+    options.use_mmap = cache == nullptr;
+    options.block_cache = std::move(cache);
+    options.lookup_layout = KeyIndex::Layout::INTERPOLATION;
+    options.sparse_index_interval = 256;
+
+    ISAMStorage barrel_store(idx_path, dat_path, options);
+    std::string scratch;
+    auto result = barrel_store.read_view(word_id, scratch);
     if (!result.has_value()) return EMPTY_POSTINGS_LIST;
 
+    // Parse straight out of the record
     postings_list_t postings;
-    std::stringstream ss(result->second);
-    std::string segment;
-    while(std::getline(ss, segment, ',')) {
-        if(!segment.empty()) postings.push_back({(uint32_t)std::stoul(segment)});
+    const char* pos = result->second.data();
+    const char* end = pos + result->second.size();
+    while (pos < end) {
+        uint32_t doc_id = 0;
+        auto res = std::from_chars(pos, end, doc_id);
+        if (res.ec == std::errc()) postings.push_back({doc_id});
+
+        const char* comma = std::find(res.ptr, end, ',');
+        pos = comma == end ? end : comma + 1;
     }
 
     return postings;
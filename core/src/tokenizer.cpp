@@ -0,0 +1,378 @@
+#include "tokenizer.hpp"
+
+#include <atomic>
+#include <cstring>
+
+#include "case_folding.hpp"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define TOKENIZER_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+// Bulk byte operations behind the tokenizer, every backend gives the same results
+struct Tokenizer::Kernels {
+    Backend backend;
+    // Bit i of space / upper / multibyte is set if byte i of the 64 at data is whitespace / an ASCII
+    // uppercase letter / part of a multibyte UTF-8 sequence
+    void (*classify)(const char* data, uint64_t& space, uint64_t& upper, uint64_t& multibyte);
+    // First ASCII uppercase letter, size if there is none
+    size_t (*find_upper)(const char* data, size_t size);
+    // First byte with the high bit set, size if the text is all ASCII
+    size_t (*find_multibyte)(const char* data, size_t size);
+    // Copies size bytes from data to out with ASCII letters lowercased
+    void (*lower)(const char* data, size_t size, char* out);
+};
+
+static constexpr size_t BLOCK_SIZE = 64;
+
+static bool is_upper(char c) {
+    return c >= 'A' && c <= 'Z';
+}
+
+//  SCALAR
+static bool is_multibyte(char c) {
+    return static_cast<uint8_t>(c) >= 0x80;
+}
+
+static void classify_scalar(const char* data, uint64_t& space, uint64_t& upper, uint64_t& multibyte) {
+    space = 0;
+    upper = 0;
+    multibyte = 0;
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        space |= static_cast<uint64_t>(Tokenizer::is_space(data[i])) << i;
+        upper |= static_cast<uint64_t>(is_upper(data[i])) << i;
+        multibyte |= static_cast<uint64_t>(is_multibyte(data[i])) << i;
+    }
+}
+
+static size_t find_upper_scalar(const char* data, size_t size) {
+    size_t pos = 0;
+    while (pos < size && !is_upper(data[pos])) pos++;
+    return pos;
+}
+
+static size_t find_multibyte_scalar(const char* data, size_t size) {
+    // Eight bytes at a time, ASCII text has none of the high bits set
+    size_t pos = 0;
+    for (; pos + 8 <= size; pos += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + pos, 8);
+        if ((word & 0x8080808080808080ULL) != 0) break;
+    }
+    while (pos < size && !is_multibyte(data[pos])) pos++;
+    return pos;
+}
+
+static void lower_scalar(const char* data, size_t size, char* out) {
+    for (size_t i = 0; i < size; i++) {
+        out[i] = is_upper(data[i]) ? static_cast<char>(data[i] + ('a' - 'A')) : data[i];
+    }
+}
+
+static const Tokenizer::Kernels SCALAR_KERNELS = {
+    Tokenizer::Backend::SCALAR, classify_scalar, find_upper_scalar, find_multibyte_scalar, lower_scalar
+};
+
+#ifdef TOKENIZER_X86_KERNELS
+// Range checks are done with one signed compare: adding 0x80 - low moves [low, high] to the bottom of
+// the signed byte range, so a byte is inside iff the sum is below -128 + (high - low + 1)
+
+//  SSE2, part of every x86-64 CPU
+static __m128i space_mask_sse2(__m128i v) {
+    __m128i blank = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8(static_cast<char>(0x80 - '\t')));
+    __m128i control = _mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(-128 + ('\r' - '\t' + 1))));
+    return _mm_or_si128(blank, control);
+}
+
+static __m128i upper_mask_sse2(__m128i v) {
+    __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8(static_cast<char>(0x80 - 'A')));
+    return _mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(-128 + 26)));
+}
+
+static uint64_t movemask_sse2(__m128i mask) {
+    return static_cast<uint16_t>(_mm_movemask_epi8(mask));
+}
+
+// The movemask of the bytes themselves is their high bits, set for every byte of a multibyte sequence
+static void classify_sse2(const char* data, uint64_t& space, uint64_t& upper, uint64_t& multibyte) {
+    space = 0;
+    upper = 0;
+    multibyte = 0;
+    for (size_t i = 0; i < BLOCK_SIZE; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        space |= movemask_sse2(space_mask_sse2(v)) << i;
+        upper |= movemask_sse2(upper_mask_sse2(v)) << i;
+        multibyte |= movemask_sse2(v) << i;
+    }
+}
+
+static size_t find_upper_sse2(const char* data, size_t size) {
+    size_t pos = 0;
+    for (; pos + 16 <= size; pos += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        unsigned upper = static_cast<unsigned>(_mm_movemask_epi8(upper_mask_sse2(v)));
+        if (upper != 0) return pos + __builtin_ctz(upper);
+    }
+    return pos + find_upper_scalar(data + pos, size - pos);
+}
+
+static size_t find_multibyte_sse2(const char* data, size_t size) {
+    size_t pos = 0;
+    for (; pos + 16 <= size; pos += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        unsigned multibyte = static_cast<unsigned>(_mm_movemask_epi8(v));
+        if (multibyte != 0) return pos + __builtin_ctz(multibyte);
+    }
+    return pos + find_multibyte_scalar(data + pos, size - pos);
+}
+
+static void lower_sse2(const char* data, size_t size, char* out) {
+    size_t pos = 0;
+    for (; pos + 16 <= size; pos += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        __m128i offset = _mm_and_si128(upper_mask_sse2(v), _mm_set1_epi8('a' - 'A'));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + pos), _mm_add_epi8(v, offset));
+    }
+    lower_scalar(data + pos, size - pos, out + pos);
+}
+
+static const Tokenizer::Kernels SSE2_KERNELS = {
+    Tokenizer::Backend::SSE2, classify_sse2, find_upper_sse2, find_multibyte_sse2, lower_sse2
+};
+
+//  AVX2, only called after checking the CPU for it
+// Tails go to the scalar code, calling the non-VEX SSE2 kernels with dirty upper halves of the ymm
+// registers costs a state transition on every call
+#define TOKENIZER_AVX2 __attribute__((target("avx2")))
+
+TOKENIZER_AVX2 static __m256i space_mask_avx2(__m256i v) {
+    __m256i blank = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    __m256i shifted = _mm256_add_epi8(v, _mm256_set1_epi8(static_cast<char>(0x80 - '\t')));
+    __m256i control = _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(-128 + ('\r' - '\t' + 1))), shifted);
+    return _mm256_or_si256(blank, control);
+}
+
+TOKENIZER_AVX2 static __m256i upper_mask_avx2(__m256i v) {
+    __m256i shifted = _mm256_add_epi8(v, _mm256_set1_epi8(static_cast<char>(0x80 - 'A')));
+    return _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(-128 + 26)), shifted);
+}
+
+TOKENIZER_AVX2 static uint64_t movemask_avx2(__m256i mask) {
+    return static_cast<uint32_t>(_mm256_movemask_epi8(mask));
+}
+
+TOKENIZER_AVX2 static void classify_avx2(const char* data, uint64_t& space, uint64_t& upper, uint64_t& multibyte) {
+    __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+    __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 32));
+    space = movemask_avx2(space_mask_avx2(low)) | (movemask_avx2(space_mask_avx2(high)) << 32);
+    upper = movemask_avx2(upper_mask_avx2(low)) | (movemask_avx2(upper_mask_avx2(high)) << 32);
+    multibyte = movemask_avx2(low) | (movemask_avx2(high) << 32);
+}
+
+TOKENIZER_AVX2 static size_t find_upper_avx2(const char* data, size_t size) {
+    size_t pos = 0;
+    for (; pos + 32 <= size; pos += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+        unsigned upper = static_cast<unsigned>(_mm256_movemask_epi8(upper_mask_avx2(v)));
+        if (upper != 0) return pos + __builtin_ctz(upper);
+    }
+    return pos + find_upper_scalar(data + pos, size - pos);
+}
+
+TOKENIZER_AVX2 static size_t find_multibyte_avx2(const char* data, size_t size) {
+    size_t pos = 0;
+    for (; pos + 32 <= size; pos += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+        unsigned multibyte = static_cast<unsigned>(_mm256_movemask_epi8(v));
+        if (multibyte != 0) return pos + __builtin_ctz(multibyte);
+    }
+    return pos + find_multibyte_scalar(data + pos, size - pos);
+}
+
+TOKENIZER_AVX2 static void lower_avx2(const char* data, size_t size, char* out) {
+    size_t pos = 0;
+    for (; pos + 32 <= size; pos += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+        __m256i offset = _mm256_and_si256(upper_mask_avx2(v), _mm256_set1_epi8('a' - 'A'));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + pos), _mm256_add_epi8(v, offset));
+    }
+    lower_scalar(data + pos, size - pos, out + pos);
+}
+
+static const Tokenizer::Kernels AVX2_KERNELS = {
+    Tokenizer::Backend::AVX2, classify_avx2, find_upper_avx2, find_multibyte_avx2, lower_avx2
+};
+#endif
+
+static std::atomic<const Tokenizer::Kernels*> selected_kernels{nullptr};
+
+// Kernels of a backend, null if it cannot run here
+static const Tokenizer::Kernels* kernels_for(Tokenizer::Backend backend) {
+    switch (backend) {
+        case Tokenizer::Backend::SCALAR:
+            return &SCALAR_KERNELS;
+#ifdef TOKENIZER_X86_KERNELS
+        case Tokenizer::Backend::SSE2:
+            return &SSE2_KERNELS;
+        case Tokenizer::Backend::AVX2:
+            return __builtin_cpu_supports("avx2") ? &AVX2_KERNELS : nullptr;
+#endif
+        default:
+            return nullptr;
+    }
+}
+
+const Tokenizer::Kernels* Tokenizer::active_kernels() {
+    const Kernels* kernels = selected_kernels.load(std::memory_order_acquire);
+    if (kernels != nullptr) return kernels;
+
+    for (Backend backend : {Backend::AVX2, Backend::SSE2, Backend::SCALAR}) {
+        kernels = kernels_for(backend);
+        if (kernels != nullptr) break;
+    }
+    // Threads racing here all pick the same kernels
+    selected_kernels.store(kernels, std::memory_order_release);
+    return kernels;
+}
+
+Tokenizer::Backend Tokenizer::backend() {
+    return active_kernels()->backend;
+}
+
+bool Tokenizer::set_backend(Backend backend) {
+    const Kernels* kernels = kernels_for(backend);
+    if (kernels == nullptr) return false;
+    selected_kernels.store(kernels, std::memory_order_release);
+    return true;
+}
+
+const char* Tokenizer::backend_name(Backend backend) {
+    switch (backend) {
+        case Backend::SCALAR: return "scalar";
+        case Backend::SSE2:   return "sse2";
+        case Backend::AVX2:   return "avx2";
+    }
+    return "?";
+}
+
+Tokenizer::Tokenizer(std::string_view text) : text(text), kernels(active_kernels()) {}
+
+// TODO: Handle symbols properly,
+// problem is that some symbols are meaningful parts of tech terms (e.g C#, .NET, dots in versioning, etc)
+static constexpr std::string_view TRIMMED_SYMBOLS = ".,()\"'?:;[]&^%$";
+
+// Lookup table for is_trimmed(), it runs on both ends of every token
+struct TrimTable {
+    bool trimmed[256] = {};
+
+    constexpr TrimTable() {
+        for (char c : TRIMMED_SYMBOLS) trimmed[static_cast<uint8_t>(c)] = true;
+        for (char c : {' ', '\t', '\n', '\v', '\f', '\r'}) trimmed[static_cast<uint8_t>(c)] = true;
+    }
+};
+static constexpr TrimTable TRIM_TABLE;
+
+bool Tokenizer::is_trimmed(char c) {
+    return TRIM_TABLE.trimmed[static_cast<uint8_t>(c)];
+}
+
+void Tokenizer::load_block(size_t start) {
+    block_start = start;
+    block_loaded = true;
+    if (start + BLOCK_SIZE <= text.size()) {
+        kernels->classify(text.data() + start, space_bits, upper_bits, multibyte_bits);
+        return;
+    }
+
+    // The last block is padded with spaces, they end the final token
+    char padded[BLOCK_SIZE];
+    std::memset(padded, ' ', BLOCK_SIZE);
+    std::memcpy(padded, text.data() + start, text.size() - start);
+    kernels->classify(padded, space_bits, upper_bits, multibyte_bits);
+}
+
+std::optional<std::string_view> Tokenizer::next() {
+    size_t size = text.size();
+    while (pos < size) {
+        // Skip whitespace
+        while (true) {
+            if (pos >= size) return std::nullopt;
+            if (!block_loaded || pos >= block_start + BLOCK_SIZE) load_block(pos - pos % BLOCK_SIZE);
+
+            uint64_t other = ~space_bits >> (pos - block_start);
+            if (other != 0) {
+                pos += __builtin_ctzll(other);
+                break;
+            }
+            pos = block_start + BLOCK_SIZE;
+        }
+
+        // The token runs up to the next whitespace, which may be blocks away
+        size_t start = pos;
+        bool has_upper = false;
+        bool has_multibyte = false;
+        while (true) {
+            if (pos >= block_start + BLOCK_SIZE) {
+                if (pos >= size) break;
+                load_block(pos);
+            }
+
+            size_t offset = pos - block_start;
+            uint64_t space = space_bits >> offset;
+            uint64_t upper = upper_bits >> offset;
+            uint64_t multibyte = multibyte_bits >> offset;
+            if (space != 0) {
+                size_t length = __builtin_ctzll(space);
+                uint64_t token_bits = (uint64_t(1) << length) - 1;
+                has_upper |= (upper & token_bits) != 0;
+                has_multibyte |= (multibyte & token_bits) != 0;
+                pos += length;
+                break;
+            }
+            has_upper |= upper != 0;
+            has_multibyte |= multibyte != 0;
+            pos = block_start + BLOCK_SIZE;
+        }
+        if (pos > size) pos = size;
+
+        std::string_view token = normalize(text.substr(start, pos - start), has_upper, has_multibyte, kernels);
+        if (!token.empty()) return token;
+    }
+    return std::nullopt;
+}
+
+std::string_view Tokenizer::normalize(std::string_view token) {
+    const Kernels* kernels = active_kernels();
+    bool has_upper = kernels->find_upper(token.data(), token.size()) < token.size();
+    bool has_multibyte = kernels->find_multibyte(token.data(), token.size()) < token.size();
+    return normalize(token, has_upper, has_multibyte, kernels);
+}
+
+std::string_view Tokenizer::normalize(std::string_view token, bool has_upper, bool has_multibyte,
+                                      const Kernels* kernels) {
+    size_t begin = 0;
+    size_t end = token.size();
+    while (begin < end && is_trimmed(token[begin])) begin++;
+    while (end > begin && is_trimmed(token[end - 1])) end--;
+    token = token.substr(begin, end - begin);
+
+    // Lowercase ASCII tokens are returned as they are, only the others are copied. Trimming only drops
+    // ASCII symbols, so has_upper and has_multibyte still hold
+    if (!has_upper && !has_multibyte) return token;
+
+    thread_local std::string scratch;
+    if (!has_multibyte) {
+        scratch.resize(token.size());
+        kernels->lower(token.data(), token.size(), &scratch[0]);
+        return scratch;
+    }
+
+    // The ASCII prefix is lowercased in bulk, case folding decodes from the first multibyte sequence on
+    size_t prefix = kernels->find_multibyte(token.data(), token.size());
+    scratch.resize(prefix);
+    kernels->lower(token.data(), prefix, &scratch[0]);
+    CaseFolding::fold_utf8(token.substr(prefix), scratch);
+    return scratch;
+}
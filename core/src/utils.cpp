@@ -1,9 +1,20 @@
 
 #include "utils.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <iostream>
-#include <regex>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <sstream>
+#include <thread>
+#include "html_entities.hpp"
 #include "pugixml.hpp"
+#include "tokenizer.hpp"
+#include "utf8.hpp"
+#include "xml_row_reader.hpp"
 
 // Helper function to parse tags from "|tag1|tag2|" format
 std::vector<std::string> Utils::parse_tags(const std::string& tags_str) {
@@ -30,130 +41,312 @@ std::vector<std::string> Utils::parse_tags(const std::string& tags_str) {
 }
 
 std::string Utils::extract_text_from_html(const std::string& html) {
-    if (html.empty()) {
-        return "";
+    std::string text;
+    extract_text_from_html(html, text);
+    return text;
+}
+
+// Whitespace as matched by \s
+static bool is_html_space(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+void Utils::extract_text_from_html(std::string_view html, std::string& text) {
+    text.clear();
+    text.reserve(html.size());
+
+    const char* data = html.data();
+    size_t size = html.size();
+    size_t pos = 0;
+
+    // Whitespace is written as one space once the next character follows it, so none is left at the ends
+    bool pending_space = false;
+    auto before_character = [&]() {
+        if (pending_space && !text.empty()) text += ' ';
+        pending_space = false;
+    };
+
+    while (pos < size) {
+        // Plain text is copied in runs
+        size_t run = pos;
+        while (run < size && data[run] != '<' && data[run] != '&' && !is_html_space(data[run])) {
+            run++;
+        }
+        if (run > pos) {
+            before_character();
+            text.append(data + pos, run - pos);
+            pos = run;
+            if (pos == size) break;
+        }
+
+        char c = data[pos];
+        if (c == '<') {
+            // A tag runs up to the next '>', a '<' without one is text
+            const void* close = std::memchr(data + pos + 1, '>', size - pos - 1);
+            if (close != nullptr) {
+                pos = static_cast<const char*>(close) - data + 1;
+                continue;
+            }
+        } else if (c == '&') {
+            // Decoded characters are text, "&amp;lt;" stays "&lt;"
+            uint32_t code_point;
+            size_t length = HtmlEntities::decode(html.substr(pos), code_point);
+            if (length > 0) {
+                pos += length;
+                // &nbsp; separates words like a space
+                if (code_point < 0x80 ? is_html_space(static_cast<char>(code_point)) : code_point == 0xA0) {
+                    pending_space = true;
+                } else {
+                    before_character();
+                    Utf8::append(code_point, text);
+                }
+                continue;
+            }
+        } else {
+            pending_space = true;
+            pos++;
+            continue;
+        }
+
+        // Unmatched '<' or '&'
+        before_character();
+        text += c;
+        pos++;
     }
+}
 
-    std::string result = html;
 
-    // Remove all HTML tags
-    result = std::regex_replace(result, std::regex("<[^>]*>"), "");
+Post Utils::post_from_row(const pugi::xml_node& row, SiteID site_id, bool clean_body) {
+    Post post;
 
-    // Decode basic entities
-    result = std::regex_replace(result, std::regex("&amp;"), "&");
-    result = std::regex_replace(result, std::regex("&lt;"), "<");
-    result = std::regex_replace(result, std::regex("&gt;"), ">");
-    result = std::regex_replace(result, std::regex("&nbsp;"), " ");
+    // Basic identification
+    post.site_id = site_id;
+    post.post_id = row.attribute("Id").as_uint();
+    post.post_type_id = row.attribute("PostTypeId").as_uint();
 
-    // Normalize whitespace
-    result = std::regex_replace(result, std::regex("\\s+"), " ");
-    result = std::regex_replace(result, std::regex("^ | $"), "");
+    // Content
+    if (auto title_attr = row.attribute("Title")) {
+        post.title = title_attr.as_string();
+    }
 
-    return result;
-}
+    if (auto body_attr = row.attribute("Body")) {
+        post.body = body_attr.as_string();
 
+        // Keep a clean version as well as the original
+        if (clean_body) {
+            Utils::extract_text_from_html(post.body, post.cleaned_body);
+        }
+    }
 
-// Function to parse XML into Post objects with configurable limit
-std::vector<Post> Utils::parse_posts_from_xml(const std::string& xml_file_path,
-                                      SiteID site_id,
-                                      size_t limit) {
-    std::vector<Post> posts;
+    if (auto tags_attr = row.attribute("Tags")) {
+        post.tags = Utils::parse_tags(tags_attr.as_string());
+    }
 
-    // Load XML document
-    pugi::xml_document doc;
-    pugi::xml_parse_result result = doc.load_file(xml_file_path.c_str());
+    // Relationships
+    if (auto parent_attr = row.attribute("ParentId")) {
+        post.parent_id = parent_attr.as_uint();
+    }
 
-    if (!result) {
-        std::cerr << "XML parse error: " << result.description()
-                  << " at offset " << result.offset << std::endl;
-        return posts;
+    if (auto accepted_attr = row.attribute("AcceptedAnswerId")) {
+        post.accepted_answer_id = accepted_attr.as_uint();
     }
 
-    // Find all row elements
-    pugi::xml_node posts_node = doc.child("posts");
-    if (!posts_node) {
-        std::cerr << "No 'posts' root element found" << std::endl;
-        return posts;
+    // User info
+    if (auto owner_attr = row.attribute("OwnerUserId")) {
+        post.owner_user_id = owner_attr.as_uint();
     }
 
-    size_t count = 0;
-    std::cout << "Loading posts into memory..." << std::flush;
+    if (auto editor_attr = row.attribute("LastEditorUserId")) {
+        post.last_editor_user_id = editor_attr.as_uint();
+    }
 
-    // Iterate through each row
-    for (pugi::xml_node row : posts_node.children("row")) {
-        if (count >= limit) {
-            break; // Stop when we hit the limit
-        }
+    // Metrics
+    post.score = row.attribute("Score").as_int();
+    post.view_count = row.attribute("ViewCount").as_uint();
+    post.answer_count = row.attribute("AnswerCount").as_uint();
+    post.comment_count = row.attribute("CommentCount").as_uint();
 
-        Post post;
+    // Timestamps
+    if (auto creation_attr = row.attribute("CreationDate")) {
+        post.creation_date = creation_attr.as_string();
+    }
 
-        // Basic identification
-        post.site_id = site_id;
-        post.post_id = row.attribute("Id").as_uint();
-        post.post_type_id = row.attribute("PostTypeId").as_uint();
+    if (auto edit_attr = row.attribute("LastEditDate")) {
+        post.last_edit_date = edit_attr.as_string();
+    }
 
-        // Content
-        if (auto title_attr = row.attribute("Title")) {
-            post.title = title_attr.as_string();
-        }
+    if (auto activity_attr = row.attribute("LastActivityDate")) {
+        post.last_activity_date = activity_attr.as_string();
+    }
 
-        if (auto body_attr = row.attribute("Body")) {
-            post.body = body_attr.as_string();
+    // Metadata
+    if (auto license_attr = row.attribute("ContentLicense")) {
+        post.content_license = license_attr.as_string();
+    }
 
-            // Keep a clean version as well as the original
-            post.cleaned_body = Utils::extract_text_from_html(post.body);
-        }
+    return post;
+}
 
-        if (auto tags_attr = row.attribute("Tags")) {
-            post.tags = parse_tags(tags_attr.as_string());
-        }
+// Fields of one <row> of Comments.xml
+static Comment comment_from_row(const pugi::xml_node& row, SiteID site_id) {
+    Comment comment;
 
-        // Relationships
-        if (auto parent_attr = row.attribute("ParentId")) {
-            post.parent_id = parent_attr.as_uint();
-        }
+    // Basic identification
+    comment.site_id = site_id;
+    comment.comment_id = row.attribute("Id").as_uint();
+    comment.post_id = row.attribute("PostId").as_uint();
 
-        if (auto accepted_attr = row.attribute("AcceptedAnswerId")) {
-            post.accepted_answer_id = accepted_attr.as_uint();
-        }
+    // Content
+    if (auto text_attr = row.attribute("Text")) {
+        comment.text = text_attr.as_string();
+    }
 
-        // User info
-        if (auto owner_attr = row.attribute("OwnerUserId")) {
-            post.owner_user_id = owner_attr.as_uint();
-        }
+    // User info
+    if (auto user_attr = row.attribute("UserId")) {
+        comment.user_id = user_attr.as_uint();
+    }
 
-        if (auto editor_attr = row.attribute("LastEditorUserId")) {
-            post.last_editor_user_id = editor_attr.as_uint();
-        }
+    // Metrics
+    comment.score = row.attribute("Score").as_int();
 
-        // Metrics
-        post.score = row.attribute("Score").as_int();
-        post.view_count = row.attribute("ViewCount").as_uint();
-        post.answer_count = row.attribute("AnswerCount").as_uint();
-        post.comment_count = row.attribute("CommentCount").as_uint();
+    // Timestamps
+    if (auto creation_attr = row.attribute("CreationDate")) {
+        comment.creation_date = creation_attr.as_string();
+    }
 
-        // Timestamps
-        if (auto creation_attr = row.attribute("CreationDate")) {
-            post.creation_date = creation_attr.as_string();
-        }
+    return comment;
+}
+
+// Size of the row chunks parsed by one worker in the parallel path
+static constexpr size_t PARSE_CHUNK_SIZE = 1024 * 1024;
+
+size_t Utils::for_each_post(const std::string& xml_file_path, SiteID site_id,
+                            const std::function<void(Post&&)>& on_post, size_t limit, int threads) {
+    XmlRowReader reader;
+    if (!reader.open(xml_file_path)) {
+        std::cerr << "Could not open " << xml_file_path << std::endl;
+        return 0;
+    }
+
+    size_t count = 0;
+    uint64_t skipped = 0;
 
-        if (auto edit_attr = row.attribute("LastEditDate")) {
-            post.last_edit_date = edit_attr.as_string();
+    if (threads <= 1) {
+        while (count < limit) {
+            auto row = reader.next();
+            if (!row.has_value()) break;
+
+            on_post(post_from_row(*row, site_id));
+            count++;
+        }
+    } else {
+        // Chunks of whole rows are cut off here and parsed on the workers. At most two chunks per worker
+        // are in flight and results go out in file order, so the output does not depend on scheduling
+        struct Batch {
+            std::string xml;
+            std::vector<Post> posts;
+            uint64_t skipped = 0;
+            bool done = false;
+        };
+
+        std::mutex mutex;
+        std::condition_variable work_ready;
+        std::condition_variable batch_done;
+        std::deque<std::shared_ptr<Batch> > jobs;
+        bool stop = false;
+
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&]() {
+                XmlRowReader parser;
+                while (true) {
+                    std::shared_ptr<Batch> batch;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        work_ready.wait(lock, [&]() { return stop || !jobs.empty(); });
+                        if (jobs.empty()) return;
+                        batch = std::move(jobs.front());
+                        jobs.pop_front();
+                    }
+
+                    parser.open_buffer(std::move(batch->xml));
+                    while (auto row = parser.next()) {
+                        batch->posts.push_back(post_from_row(*row, site_id));
+                    }
+
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        batch->skipped = parser.skipped_rows();
+                        batch->done = true;
+                    }
+                    batch_done.notify_all();
+                }
+            });
         }
 
-        if (auto activity_attr = row.attribute("LastActivityDate")) {
-            post.last_activity_date = activity_attr.as_string();
+        std::deque<std::shared_ptr<Batch> > in_flight;
+        size_t window = 2 * static_cast<size_t>(threads);
+        bool input_left = true;
+        while (count < limit) {
+            while (input_left && in_flight.size() < window) {
+                auto chunk = reader.next_chunk(PARSE_CHUNK_SIZE);
+                if (!chunk.has_value()) {
+                    input_left = false;
+                    break;
+                }
+                auto batch = std::make_shared<Batch>();
+                batch->xml = std::move(*chunk);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    jobs.push_back(batch);
+                }
+                work_ready.notify_one();
+                in_flight.push_back(std::move(batch));
+            }
+            if (in_flight.empty()) break;
+
+            std::shared_ptr<Batch> batch = std::move(in_flight.front());
+            in_flight.pop_front();
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                batch_done.wait(lock, [&]() { return batch->done; });
+            }
+
+            skipped += batch->skipped;
+            for (Post& post : batch->posts) {
+                if (count >= limit) break;
+                on_post(std::move(post));
+                count++;
+            }
         }
 
-        // Metadata
-        if (auto license_attr = row.attribute("ContentLicense")) {
-            post.content_license = license_attr.as_string();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+            jobs.clear();
         }
+        work_ready.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
 
-        posts.push_back(post);
-        std::cout << "\rLoaded " << count + 1 << " posts into memory." << std::flush;
-        count++;
+    skipped += reader.skipped_rows();
+    if (skipped > 0) {
+        std::cerr << "Skipped " << skipped << " malformed rows in " << xml_file_path << std::endl;
     }
+    return count;
+}
+
+// Function to parse XML into Post objects with configurable limit
+std::vector<Post> Utils::parse_posts_from_xml(const std::string& xml_file_path,
+                                      SiteID site_id,
+                                      size_t limit) {
+    std::vector<Post> posts;
+
+    std::cout << "Loading posts into memory..." << std::flush;
+    for_each_post(xml_file_path, site_id, [&](Post&& post) {
+        posts.push_back(std::move(post));
+        std::cout << "\rLoaded " << posts.size() << " posts into memory." << std::flush;
+    }, limit);
     std::cout << std::endl << "Loading Complete!" << std::endl;
 
     return posts;
@@ -164,20 +357,9 @@ std::vector<Comment> Utils::parse_comments_from_xml(const std::string& xml_file_
                                            size_t limit) {
     std::vector<Comment> comments;
 
-    // Load XML document
-    pugi::xml_document doc;
-    pugi::xml_parse_result result = doc.load_file(xml_file_path.c_str());
-
-    if (!result) {
-        std::cerr << "XML parse error: " << result.description()
-                  << " at offset " << result.offset << std::endl;
-        return comments;
-    }
-
-    // Find all row elements
-    pugi::xml_node comments_node = doc.child("comments");
-    if (!comments_node) {
-        std::cerr << "No 'comments' root element found" << std::endl;
+    XmlRowReader reader;
+    if (!reader.open(xml_file_path)) {
+        std::cerr << "Could not open " << xml_file_path << std::endl;
         return comments;
     }
 
@@ -185,37 +367,14 @@ std::vector<Comment> Utils::parse_comments_from_xml(const std::string& xml_file_
     std::cout << "Loading comments into memory..." << std::flush;
 
     // Iterate through each row
-    for (pugi::xml_node row : comments_node.children("row")) {
+    while (true) {
         if (limit > 0 && count >= limit) {
             break; // Stop when we hit the limit
         }
+        auto row = reader.next();
+        if (!row.has_value()) break;
 
-        Comment comment;
-
-        // Basic identification
-        comment.site_id = site_id;
-        comment.comment_id = row.attribute("Id").as_uint();
-        comment.post_id = row.attribute("PostId").as_uint();
-
-        // Content
-        if (auto text_attr = row.attribute("Text")) {
-            comment.text = text_attr.as_string();
-        }
-
-        // User info
-        if (auto user_attr = row.attribute("UserId")) {
-            comment.user_id = user_attr.as_uint();
-        }
-
-        // Metrics
-        comment.score = row.attribute("Score").as_int();
-
-        // Timestamps
-        if (auto creation_attr = row.attribute("CreationDate")) {
-            comment.creation_date = creation_attr.as_string();
-        }
-
-        comments.push_back(comment);
+        comments.push_back(comment_from_row(*row, site_id));
         std::cout << "\rLoaded " << count + 1 << " comments into memory." << std::flush;
         count++;
     }
@@ -224,63 +383,90 @@ std::vector<Comment> Utils::parse_comments_from_xml(const std::string& xml_file_
     return comments;
 }
 
-void Utils::generate_data_index(ISAMStorage& data_index, const std::string& post_file) {
-    auto posts = parse_posts_from_xml(post_file, SiteID::ASK_UBUNTU);
-
-    // Generate entries
-    std::vector<std::pair<uint64_t, std::string>> p_entries;
-    p_entries.reserve(posts.size());
+void Utils::generate_data_index(ISAMStorage& data_index, const std::string& post_file, bool train_dictionary,
+                                int threads) {
+    if (train_dictionary) {
+        // A first pass draws samples spread over the whole file (reservoir sampling, fixed seed so
+        // rebuilds are identical), zstd wants about 100 times the dictionary size in samples
+        const size_t max_samples = 4000;
+        std::vector<std::string> samples;
+        std::mt19937_64 rng(42);
+        size_t seen = 0;
+        for_each_post(post_file, SiteID::ASK_UBUNTU, [&](Post&& post) {
+            seen++;
+            if (samples.size() < max_samples) {
+                samples.push_back(Post::to_binary(post));
+            } else {
+                size_t slot = std::uniform_int_distribution<size_t>(0, seen - 1)(rng);
+                if (slot < max_samples) samples[slot] = Post::to_binary(post);
+            }
+        }, SIZE_MAX, threads);
+
+        auto dictionary = RecordDictionary::train(samples);
+        if (dictionary && data_index.set_dictionary(dictionary)) {
+            std::cout << "Trained a " << dictionary->size() << " byte dictionary on " << samples.size()
+                      << " posts." << std::endl;
+        } else {
+            std::cout << "Writing the data index without a dictionary." << std::endl;
+        }
+    }
 
+    // Posts go to the data file as they come out of the parser, nothing is held in memory
+    auto writer = data_index.bulk_writer();
 
     KeyType p_type = KeyType::POST_BY_ID;
     SiteID p_site = SiteID::ASK_UBUNTU;
-    for (const auto& post : posts) {
-        uint32_t p_id = post.post_id;
-
-        CompoundKey k(static_cast<uint8_t>(p_type), static_cast<uint16_t>(p_site), p_id, 0);
-
-        nlohmann::json j = Post::to_json(post);
-
-        p_entries.emplace_back(k.pack(), j.dump(4));
-    }
-
     std::cout << "Writing post data...." << std::endl;
-    data_index.write(p_entries);
-    std::cout << "Data for " << posts.size() << " posts written to data index.\n" << std::endl;
-
+    size_t written = for_each_post(post_file, p_site, [&](Post&& post) {
+        CompoundKey k(static_cast<uint8_t>(p_type), static_cast<uint16_t>(p_site), post.post_id, 0);
+        writer.append(k.pack(), Post::to_binary(post));
 
+        if (writer.count() % 1000 == 0) {
+            std::cout << "\rWrote " << writer.count() << " posts." << std::flush;
+        }
+    }, SIZE_MAX, threads);
+    writer.finish();
+    std::cout << "\rData for " << written << " posts written to data index.\n" << std::endl;
 }
 
-Lexicon Utils::generate_lexicon(ISAMStorage &data_index) {
+Lexicon Utils::generate_lexicon(const ISAMStorage &data_index) {
     Lexicon l;
 
     int count = 0;
     std::cout << "Adding words to lexicon..." << std::endl;
+    // Only posts carry text, the scan skips every other key type
+    auto cursor = data_index.scan_prefix(KeyType::POST_BY_ID);
+    std::string converted; // Only used for JSON records
+
+    // Tokens go straight into the lexicon without being copied
+    auto add_tokens = [&l](std::string_view text) {
+        Tokenizer tokenizer(text);
+        while (auto token = tokenizer.next()) l.add_word(*token);
+    };
+
     while (true) {
-        auto entry = data_index.next();
+        auto entry = cursor.next();
 
         if (!entry.has_value()) break;
 
-        auto key = CompoundKey::unpack(entry->first);
-        auto k_type = static_cast<KeyType>(key.key_type);
-
-        if (k_type == KeyType::POST_BY_ID) {
-            Post p = Post::from_json(nlohmann::json::parse(entry->second));
+        // Fields are read straight out of the record
+        auto p = PostView::from_record(entry->second, converted);
+        if (!p.has_value()) continue;
 
-            if (p.post_type_id == 1) {  // Go over body, title and tags for questions
-                l.add_words(Lexicon::tokenize_text(p.title));
-                l.add_words(Lexicon::tokenize_text(p.cleaned_body));
+        if (p->post_type_id() == 1) {  // Go over body, title and tags for questions
+            add_tokens(p->title());
+            add_tokens(p->cleaned_body());
 
-                // Add tags after normalization
-                std::vector<std::string> n_tags(p.tags.size());
-                for (const auto& t : p.tags) {
-                    n_tags.emplace_back(Lexicon::normalize_token(t));
-                }
-                l.add_words(n_tags);
-            }
-            else if (p.post_type_id == 2) { // Go over body only for answers
-                l.add_words(Lexicon::tokenize_text(p.cleaned_body));
+            // Add tags after normalization
+            std::vector<std::string> n_tags;
+            n_tags.reserve(p->tag_count());
+            for (uint32_t i = 0; i < p->tag_count(); i++) {
+                n_tags.emplace_back(Lexicon::normalize_token(p->tag(i)));
             }
+            l.add_words(n_tags);
+        }
+        else if (p->post_type_id() == 2) { // Go over body only for answers
+            add_tokens(p->cleaned_body());
         }
         std::cout << "\rLoaded " << count + 1 << " entries, lexicon has " << l.size() << " tokens." << std::flush;
         count++;
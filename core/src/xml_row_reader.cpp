@@ -0,0 +1,142 @@
+#include "xml_row_reader.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+bool XmlRowReader::open(const std::string& path) {
+    in.close();
+    in.clear();
+    opened = false;
+    in.open(path, std::ios::binary);
+    if (!in) return false;
+
+    buffer.assign(buffer_size, '\0');
+    begin = 0;
+    end = 0;
+    at_eof = false;
+    opened = true;
+    skipped = 0;
+    return true;
+}
+
+void XmlRowReader::open_buffer(std::string data) {
+    in.close();
+    in.clear();
+
+    buffer = std::move(data);
+    begin = 0;
+    end = buffer.size();
+    at_eof = true;
+    opened = true;
+    skipped = 0;
+}
+
+bool XmlRowReader::refill() {
+    if (at_eof) return false;
+
+    if (begin > 0) {
+        std::memmove(&buffer[0], buffer.data() + begin, end - begin);
+        end -= begin;
+        begin = 0;
+    }
+    // Only a row longer than the whole buffer makes it grow
+    if (end == buffer.size()) {
+        buffer.resize(buffer.size() * 2);
+    }
+
+    in.read(&buffer[end], static_cast<std::streamsize>(buffer.size() - end));
+    size_t got = static_cast<size_t>(in.gcount());
+    if (got == 0) {
+        at_eof = true;
+        return false;
+    }
+    end += got;
+    return true;
+}
+
+std::optional<size_t> XmlRowReader::element_end(size_t start) const {
+    const char* data = buffer.data();
+    size_t pos = start;
+    while (pos < end) {
+        char c = data[pos];
+        if (c == '>') return pos + 1;
+
+        if (c == '"' || c == '\'') {
+            // Attribute values hold most of the bytes, jump straight to the closing quote
+            const void* close = std::memchr(data + pos + 1, c, end - pos - 1);
+            if (close == nullptr) return std::nullopt;
+            pos = static_cast<const char*>(close) - data + 1;
+        } else {
+            pos++;
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<std::pair<size_t, size_t> > XmlRowReader::next_row_bounds() {
+    if (!opened) return std::nullopt;
+
+    while (true) {
+        std::string_view input(buffer.data() + begin, end - begin);
+
+        // "<row" followed by something that ends the name, "<rows>" does not count
+        size_t found = input.find("<row");
+        while (found != std::string_view::npos && found + 4 < input.size()) {
+            char after = input[found + 4];
+            if (after == ' ' || after == '\t' || after == '\r' || after == '\n' || after == '/' || after == '>') break;
+            found = input.find("<row", found + 4);
+        }
+
+        if (found == std::string_view::npos || found + 4 >= input.size()) {
+            // Keep a possibly cut off "<row" for the next round
+            size_t keep = found == std::string_view::npos ? std::min<size_t>(input.size(), 4) : input.size() - found;
+            begin = end - keep;
+            if (!refill()) return std::nullopt;
+            continue;
+        }
+
+        size_t start = begin + found;
+        auto stop = element_end(start);
+        if (!stop.has_value()) {
+            begin = start;
+            if (!refill()) {
+                // The file ends inside a row
+                skipped++;
+                return std::nullopt;
+            }
+            continue;
+        }
+        begin = *stop;
+        return std::make_pair(start, *stop);
+    }
+}
+
+std::optional<pugi::xml_node> XmlRowReader::next() {
+    while (true) {
+        auto row = next_row_bounds();
+        if (!row.has_value()) return std::nullopt;
+
+        // The row is parsed in place, its bytes are not looked at again
+        pugi::xml_parse_result result = row_document.load_buffer_inplace(&buffer[row->first], row->second - row->first,
+                                                                         pugi::parse_default, pugi::encoding_utf8);
+        if (!result) {
+            skipped++;
+            continue;
+        }
+        return row_document.first_child();
+    }
+}
+
+std::optional<std::string> XmlRowReader::next_chunk(size_t target_size) {
+    std::string chunk;
+    while (chunk.size() < target_size) {
+        // Rows are copied out one by one, a refill may move the buffer between them
+        auto row = next_row_bounds();
+        if (!row.has_value()) break;
+        chunk.append(buffer, row->first, row->second - row->first);
+        chunk += '\n';
+    }
+    if (chunk.empty()) return std::nullopt;
+    return chunk;
+}